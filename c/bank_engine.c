@@ -0,0 +1,808 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <assert.h>
+#include <sys/sysinfo.h>
+#include <time.h>
+
+#include "qlock.h"
+#include "combining.h"
+#include "util.h"
+
+#define INIT_BALANCE 1000
+#define MAX_AMOUNT 100
+#define CLAIM_BATCH 64 // requests a worker claims from the stream at once
+#define CACHE_LINE 64
+
+#define BACKOFF_TIMEOUT_NS 100000 // how long MODE_BACKOFF waits for the second lock
+#define BACKOFF_MIN_NS 100        // the first back-off, doubled after every failure
+#define BACKOFF_MAX_NS 100000
+#define BACKOFF_MAX_ATTEMPTS 64   // give the transfer up after so many attempts
+
+#define SNAPSHOT_MAX_RETRIES 16   // optimistic snapshots before the auditor locks every account
+#define AUDIT_SAMPLES (1 << 20)   // snapshot latencies the auditor keeps
+#define NODE_REFRESH 64           // transfers between two getcpu calls of a worker outside MODE_COHORT
+
+/* the account layout of bank.c: neighbors in an array share cache lines */
+typedef struct _account_t {
+    int balance;
+    pthread_mutex_t m;
+    int aid;
+} account_t;
+
+/* one cache line per account, so neighbors never false share */
+typedef struct _padded_account_t {
+    int balance;
+    pthread_mutex_t m;
+    int aid;
+} __attribute__((aligned(CACHE_LINE))) padded_account_t;
+
+/* a lock on its own cache line, for the hot/cold split */
+typedef struct _padded_mutex_t {
+    pthread_mutex_t m;
+} __attribute__((aligned(CACHE_LINE))) padded_mutex_t;
+
+typedef enum {
+    LAYOUT_PACKED, // account_t[]
+    LAYOUT_PADDED, // padded_account_t[]
+    LAYOUT_SPLIT,  // int[] of balances (dense, cheap to scan) + padded_mutex_t[]
+    N_LAYOUTS,
+} layout_t;
+
+static const char* layout_names[N_LAYOUTS] = { "packed", "padded", "split" };
+
+typedef enum {
+    MODE_MUTEX,    // `transfer`: two account mutexes in aid order
+    MODE_OPTIMISTIC, // `transfer_optimistic`: seqs validated and claimed by CAS at commit, no mutex
+    MODE_BATCH,    // `transfer_batch`: net each claimed batch, lock each account once
+    MODE_BACKOFF,  // `transfer_backoff`: from/to order, timed second lock, back off and retry
+    MODE_GLOBAL,   // `transfer_global`: one bank-wide mutex, the baseline
+    MODE_MCS,      // `transfer_global` with a bank-wide MCS lock
+    MODE_CLH,      // `transfer_global` with a bank-wide CLH lock
+    MODE_COHORT,   // `transfer_global` with a bank-wide NUMA cohort lock
+    MODE_COMBINING, // `transfer_combining`: published transfers applied in batches by one combiner
+    MODE_SNAPSHOT, // `transfer_snapshot`: MODE_MUTEX plus seqs, while an auditor sums the balances
+    N_MODES,
+} bank_mode_t;
+
+static const char* mode_names[N_MODES] = { "mutex", "optimistic", "batch", "backoff", "global", "mcs", "clh", "cohort", "combining", "snapshot" };
+
+/* a transfer request, the accounts are indices into the table (aid = index) */
+typedef struct _transfer_req_t {
+    int from;
+    int to;
+    int amount;
+} transfer_req_t;
+
+/*---------------------------- the engine ----------------------------*/
+
+typedef struct _bank_t {
+    layout_t layout;
+    bank_mode_t mode;
+    int n_accounts;
+    account_t* packed;        // LAYOUT_PACKED
+    padded_account_t* padded; // LAYOUT_PADDED
+    int* balances;            // LAYOUT_SPLIT, hot: touched by every transfer
+    unsigned* seqs;           // MODE_SNAPSHOT, MODE_OPTIMISTIC: a side array, odd while a transfer changes the balance
+    padded_mutex_t* locks;    // LAYOUT_SPLIT, cold: only the lock words
+    transfer_req_t* requests; // the stream of transfer requests
+    size_t n_requests;
+    size_t next;              // the next request to claim, shared by the workers
+    uint64_t* latency_ns;     // the service time of each request
+    pthread_mutex_t global;   // MODE_GLOBAL
+    mcs_lock_t mcs;           // MODE_MCS
+    clh_lock_t clh;           // MODE_CLH
+    cohort_lock_t cohort;     // MODE_COHORT
+    handoff_stats_t handoffs; // the bank-wide lock modes: how often it changed node
+    fc_t combiner;            // MODE_COMBINING, one slot per worker
+    int next_slot;            // MODE_COMBINING, the next free slot of `combiner`
+    long retries;             // MODE_BACKOFF: attempts that released the first lock, MODE_OPTIMISTIC: failed commits
+    long aborted;             // MODE_BACKOFF: transfers given up, their money is not moved
+    volatile int stop_audit;  // MODE_SNAPSHOT: the workers are done
+    uint64_t* audit_ns;       // MODE_SNAPSHOT: the latency of each snapshot
+    long snapshots;           // MODE_SNAPSHOT: snapshots taken by the auditor
+    long snapshot_retries;    // MODE_SNAPSHOT: optimistic snapshots that saw a transfer
+    long snapshot_fallbacks;  // MODE_SNAPSHOT: snapshots that had to lock every account
+} bank_t;
+
+static inline int* account_balance(bank_t* bank, int i) {
+    switch (bank->layout) {
+    case LAYOUT_PACKED: return &bank->packed[i].balance;
+    case LAYOUT_PADDED: return &bank->padded[i].balance;
+    default:            return &bank->balances[i];
+    }
+}
+
+/* the seqs are outside the accounts, so the other modes keep the layout of bank.c */
+static inline unsigned* account_seq(bank_t* bank, int i) {
+    return &bank->seqs[i];
+}
+
+static inline pthread_mutex_t* account_lock(bank_t* bank, int i) {
+    switch (bank->layout) {
+    case LAYOUT_PACKED: return &bank->packed[i].m;
+    case LAYOUT_PADDED: return &bank->padded[i].m;
+    default:            return &bank->locks[i].m;
+    }
+}
+
+/* the same lock ordering as `transfer` in bank.c, without the printf */
+void transfer(bank_t* bank, const transfer_req_t* tran) {
+    if (tran->from < tran->to) {
+        pthread_mutex_lock(account_lock(bank, tran->from));
+        pthread_mutex_lock(account_lock(bank, tran->to));
+    } else {
+        pthread_mutex_lock(account_lock(bank, tran->to));
+        pthread_mutex_lock(account_lock(bank, tran->from));
+    }
+
+    *account_balance(bank, tran->from) -= tran->amount;
+    *account_balance(bank, tran->to) += tran->amount;
+
+    pthread_mutex_unlock(account_lock(bank, tran->to));
+    pthread_mutex_unlock(account_lock(bank, tran->from));
+}
+
+/*!
+ * \brief transfer without any mutex, validated at commit like a seqlock:
+ * read both seqs (even) and both balances, then claim the two seqs in
+ * aid order with one CAS each, from the values read to odd. A CAS only
+ * succeeds if no transfer committed on that account since the read, so
+ * the balances read are still current; otherwise the first claim is
+ * given back unchanged and the transfer retried. Both legs are written
+ * while both seqs are odd and published together by the even seqs, so
+ * the money is never in flight for a reader that checks the seqs.
+ *
+ * The odd seqs work as a two-word spin lock, so progress is blocking,
+ * not lock-free: a committer preempted between its claims and the
+ * release stalls every transfer on those accounts until it runs again.
+ */
+void transfer_optimistic(bank_t* bank, const transfer_req_t* tran) {
+    unsigned* seq_lo = account_seq(bank, tran->from < tran->to ? tran->from : tran->to);
+    unsigned* seq_hi = account_seq(bank, tran->from < tran->to ? tran->to : tran->from);
+    int* from = account_balance(bank, tran->from);
+    int* to = account_balance(bank, tran->to);
+
+    for (int attempt = 0; ; ++attempt) {
+        if (attempt > 0) {
+            if (attempt % QLOCK_SPIN_LIMIT == 0) {
+                sched_yield(); // the transfer in our way may be preempted
+            } else {
+                cpu_relax();
+            }
+        }
+        unsigned v_lo = __atomic_load_n(seq_lo, __ATOMIC_ACQUIRE);
+        unsigned v_hi = __atomic_load_n(seq_hi, __ATOMIC_ACQUIRE);
+        if ((v_lo | v_hi) & 1) {
+            continue; // another transfer is committing on one of the accounts
+        }
+        int from_balance = __atomic_load_n(from, __ATOMIC_RELAXED);
+        int to_balance = __atomic_load_n(to, __ATOMIC_RELAXED);
+
+        if (!__atomic_compare_exchange_n(seq_lo, &v_lo, v_lo + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            __atomic_fetch_add(&bank->retries, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (!__atomic_compare_exchange_n(seq_hi, &v_hi, v_hi + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            __atomic_store_n(seq_lo, v_lo, __ATOMIC_RELEASE); // nothing was written under it
+            __atomic_fetch_add(&bank->retries, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        __atomic_store_n(from, from_balance - tran->amount, __ATOMIC_RELAXED);
+        __atomic_store_n(to, to_balance + tran->amount, __ATOMIC_RELAXED);
+        __atomic_store_n(seq_hi, v_hi + 2, __ATOMIC_RELEASE);
+        __atomic_store_n(seq_lo, v_lo + 2, __ATOMIC_RELEASE);
+        return;
+    }
+}
+
+/*---------------------------- batched transfers ----------------------------*/
+
+#define BATCH_TABLE_SIZE 256 // power of two, at least twice the accounts of a batch
+
+/* per-thread table of the net change of every account touched by a batch */
+typedef struct _batch_table_t {
+    int account[BATCH_TABLE_SIZE];       // -1 if the slot is empty
+    long long delta[BATCH_TABLE_SIZE];
+    int touched[BATCH_TABLE_SIZE / 2];   // the accounts in the table
+    int n_touched;
+} batch_table_t;
+
+void batch_table_init(batch_table_t* table) {
+    memset(table->account, -1, sizeof(table->account));
+    table->n_touched = 0;
+}
+
+void batch_table_add(batch_table_t* table, int account, long long delta) {
+    unsigned slot = (unsigned)account * 2654435761u & (BATCH_TABLE_SIZE - 1);
+    while (table->account[slot] != account && table->account[slot] != -1) {
+        slot = (slot + 1) & (BATCH_TABLE_SIZE - 1);
+    }
+    if (table->account[slot] == -1) {
+        table->account[slot] = account;
+        table->delta[slot] = 0;
+        table->touched[table->n_touched++] = account;
+    }
+    table->delta[slot] += delta;
+}
+
+long long batch_table_get(const batch_table_t* table, int account) {
+    unsigned slot = (unsigned)account * 2654435761u & (BATCH_TABLE_SIZE - 1);
+    while (table->account[slot] != account) {
+        slot = (slot + 1) & (BATCH_TABLE_SIZE - 1);
+    }
+    return table->delta[slot];
+}
+
+int cmp_int(const void* a, const void* b) {
+    return *(const int*)a - *(const int*)b;
+}
+
+/*!
+ * \brief apply `n` transfers as one atomic batch: net the deltas per
+ * account in the thread's `table`, lock the accounts with a non-zero
+ * net change in aid order, apply each net change once, and unlock. A
+ * hot account is locked once per batch instead of once per transfer.
+ *
+ * \param n, at most BATCH_TABLE_SIZE / 4 transfers
+ */
+void transfer_batch(bank_t* bank, const transfer_req_t* trans, size_t n, batch_table_t* table) {
+    assert(n * 4 <= BATCH_TABLE_SIZE);
+
+    for (size_t i = 0; i < n; ++i) {
+        batch_table_add(table, trans[i].from, -trans[i].amount);
+        batch_table_add(table, trans[i].to, trans[i].amount);
+    }
+
+    // keep only the accounts whose balance changes, sorted by aid
+    int accounts[BATCH_TABLE_SIZE / 2];
+    int n_accounts = 0;
+    for (int i = 0; i < table->n_touched; ++i) {
+        if (batch_table_get(table, table->touched[i]) != 0) {
+            accounts[n_accounts++] = table->touched[i];
+        }
+    }
+    qsort(accounts, n_accounts, sizeof(int), cmp_int);
+
+    for (int i = 0; i < n_accounts; ++i) {
+        pthread_mutex_lock(account_lock(bank, accounts[i]));
+    }
+    for (int i = 0; i < n_accounts; ++i) {
+        *account_balance(bank, accounts[i]) += batch_table_get(table, accounts[i]);
+    }
+    for (int i = n_accounts - 1; i >= 0; --i) {
+        pthread_mutex_unlock(account_lock(bank, accounts[i]));
+    }
+
+    // clear only the slots this batch used
+    for (int i = 0; i < table->n_touched; ++i) {
+        unsigned slot = (unsigned)table->touched[i] * 2654435761u & (BATCH_TABLE_SIZE - 1);
+        while (table->account[slot] != table->touched[i]) {
+            slot = (slot + 1) & (BATCH_TABLE_SIZE - 1);
+        }
+        table->account[slot] = -1;
+    }
+    table->n_touched = 0;
+}
+
+/*---------------------------- back-off and global lock ----------------------------*/
+
+static __thread unsigned int backoff_seed;
+
+/*!
+ * \brief `backoff_transfer` of deadlock.c on the engine: lock `from`
+ * then `to` with no global order, and break the ABBA cycle with a timed
+ * second lock plus an exponential, jittered back-off
+ */
+void transfer_backoff(bank_t* bank, const transfer_req_t* tran) {
+    long backoff_ns = BACKOFF_MIN_NS;
+
+    for (int attempt = 0; attempt < BACKOFF_MAX_ATTEMPTS; ++attempt) {
+        pthread_mutex_lock(account_lock(bank, tran->from));
+        if (timed_lock(account_lock(bank, tran->to), BACKOFF_TIMEOUT_NS) == 0) {
+            *account_balance(bank, tran->from) -= tran->amount;
+            *account_balance(bank, tran->to) += tran->amount;
+
+            pthread_mutex_unlock(account_lock(bank, tran->to));
+            pthread_mutex_unlock(account_lock(bank, tran->from));
+            return;
+        }
+        pthread_mutex_unlock(account_lock(bank, tran->from));
+        __atomic_fetch_add(&bank->retries, 1, __ATOMIC_RELAXED);
+
+        struct timespec pause = { 0, rand_r(&backoff_seed) % backoff_ns };
+        nanosleep(&pause, NULL);
+        backoff_ns = backoff_ns * 2 < BACKOFF_MAX_NS ? backoff_ns * 2 : BACKOFF_MAX_NS;
+    }
+    __atomic_fetch_add(&bank->aborted, 1, __ATOMIC_RELAXED);
+}
+
+/* the worker's queue nodes for the bank-wide MCS and CLH locks */
+static __thread mcs_node_t mcs_node;
+static __thread clh_handle_t clh_handle;
+
+/* the worker's node for the handoff statistics, re-read every NODE_REFRESH transfers */
+static __thread int worker_node = -1;
+static __thread unsigned worker_node_age;
+
+static inline int sampled_node() {
+    if (worker_node < 0 || ++worker_node_age % NODE_REFRESH == 0) {
+        worker_node = qlock_current_node();
+    }
+    return worker_node;
+}
+
+/*!
+ * \brief one bank-wide lock of the kind `bank->mode` says. Only the cohort
+ * lock needs the current node, the other modes count their handoffs
+ * with a node sampled every NODE_REFRESH transfers, so the mutex
+ * baseline does not pay a getcpu per transfer; a migration shows up in
+ * their handoff counts up to NODE_REFRESH transfers late.
+ */
+void transfer_global(bank_t* bank, const transfer_req_t* tran) {
+    int node = bank->mode == MODE_COHORT ? qlock_current_node() : sampled_node();
+    switch (bank->mode) {
+    case MODE_MCS:    mcs_lock(&bank->mcs, &mcs_node); break;
+    case MODE_CLH:    clh_lock(&bank->clh, &clh_handle); break;
+    case MODE_COHORT: cohort_lock(&bank->cohort, node); break;
+    default:          pthread_mutex_lock(&bank->global); break;
+    }
+    handoff_note(&bank->handoffs, node);
+
+    *account_balance(bank, tran->from) -= tran->amount;
+    *account_balance(bank, tran->to) += tran->amount;
+
+    switch (bank->mode) {
+    case MODE_MCS:    mcs_unlock(&bank->mcs, &mcs_node); break;
+    case MODE_CLH:    clh_unlock(&bank->clh, &clh_handle); break;
+    case MODE_COHORT: cohort_unlock(&bank->cohort, node); break;
+    default:          pthread_mutex_unlock(&bank->global); break;
+    }
+}
+
+/*---------------------------- flat combining ----------------------------*/
+
+/* the worker's slot in `bank->combiner` */
+static __thread int combiner_slot;
+
+/* the combiner is the only thread that touches the balances, no account lock is needed */
+void apply_transfer(void* ctx, void* op) {
+    bank_t* bank = (bank_t*)ctx;
+    const transfer_req_t* tran = (const transfer_req_t*)op;
+    *account_balance(bank, tran->from) -= tran->amount;
+    *account_balance(bank, tran->to) += tran->amount;
+}
+
+/*!
+ * \brief publish the transfer and wait until some worker applied it;
+ * the worker that wins the combiner lock applies every published
+ * transfer in one pass
+ */
+void transfer_combining(bank_t* bank, const transfer_req_t* tran) {
+    fc_execute(&bank->combiner, combiner_slot, (void*)tran);
+}
+
+/*---------------------------- snapshots ----------------------------*/
+
+/*
+ * Every account has a sequence number in `bank->seqs`, odd while a
+ * transfer changes its balance. A transfer bumps only the seqs of its
+ * own two accounts, there is no bank-wide writer counter. A reader sums
+ * the balances and then re-reads every seq (a double collect): if none
+ * moved, there was an instant between the two passes where all the
+ * balances it read were current, so the sum is consistent.
+ */
+
+/* `transfer` with the seqs of both accounts odd while the balances change */
+void transfer_snapshot(bank_t* bank, const transfer_req_t* tran) {
+    if (tran->from < tran->to) {
+        pthread_mutex_lock(account_lock(bank, tran->from));
+        pthread_mutex_lock(account_lock(bank, tran->to));
+    } else {
+        pthread_mutex_lock(account_lock(bank, tran->to));
+        pthread_mutex_lock(account_lock(bank, tran->from));
+    }
+
+    unsigned* seq_from = account_seq(bank, tran->from);
+    unsigned* seq_to = account_seq(bank, tran->to);
+    __atomic_store_n(seq_from, *seq_from + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(seq_to, *seq_to + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(account_balance(bank, tran->from), *account_balance(bank, tran->from) - tran->amount, __ATOMIC_RELAXED);
+    __atomic_store_n(account_balance(bank, tran->to), *account_balance(bank, tran->to) + tran->amount, __ATOMIC_RELAXED);
+
+    __atomic_store_n(seq_from, *seq_from + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(seq_to, *seq_to + 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(account_lock(bank, tran->to));
+    pthread_mutex_unlock(account_lock(bank, tran->from));
+}
+
+/* one double collect, returns 0 if a transfer got in the way; `seqs` is scratch space */
+int try_snapshot(bank_t* bank, unsigned* seqs, long long* total) {
+    long long sum = 0;
+    for (int i = 0; i < bank->n_accounts; ++i) {
+        seqs[i] = __atomic_load_n(account_seq(bank, i), __ATOMIC_ACQUIRE);
+        if (seqs[i] & 1) {
+            return 0;
+        }
+        sum += __atomic_load_n(account_balance(bank, i), __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    for (int i = 0; i < bank->n_accounts; ++i) {
+        if (__atomic_load_n(account_seq(bank, i), __ATOMIC_RELAXED) != seqs[i]) {
+            return 0;
+        }
+    }
+    *total = sum;
+    return 1;
+}
+
+/*!
+ * \brief a consistent total of all balances while MODE_SNAPSHOT
+ * transfers run. Transfers are never blocked unless SNAPSHOT_MAX_RETRIES
+ * optimistic attempts fail, then every account is locked in aid order
+ * (the order of `transfer`) like an auditor without seqs would have to.
+ */
+long long bank_snapshot_total(bank_t* bank, unsigned* seqs) {
+    long long total;
+    for (int attempt = 0; attempt < SNAPSHOT_MAX_RETRIES; ++attempt) {
+        if (try_snapshot(bank, seqs, &total)) {
+            return total;
+        }
+        ++bank->snapshot_retries;
+    }
+
+    ++bank->snapshot_fallbacks;
+    for (int i = 0; i < bank->n_accounts; ++i) {
+        pthread_mutex_lock(account_lock(bank, i));
+    }
+    total = 0;
+    for (int i = 0; i < bank->n_accounts; ++i) {
+        total += *account_balance(bank, i);
+    }
+    for (int i = bank->n_accounts - 1; i >= 0; --i) {
+        pthread_mutex_unlock(account_lock(bank, i));
+    }
+    return total;
+}
+
+static inline void bank_transfer(bank_t* bank, const transfer_req_t* tran) {
+    switch (bank->mode) {
+    case MODE_MUTEX:    transfer(bank, tran); break;
+    case MODE_OPTIMISTIC: transfer_optimistic(bank, tran); break;
+    case MODE_BACKOFF:  transfer_backoff(bank, tran); break;
+    case MODE_GLOBAL:
+    case MODE_MCS:
+    case MODE_CLH:
+    case MODE_COHORT:   transfer_global(bank, tran); break;
+    case MODE_COMBINING: transfer_combining(bank, tran); break;
+    case MODE_SNAPSHOT: transfer_snapshot(bank, tran); break;
+    default:            assert(0);
+    }
+}
+
+void* alloc_or_die(size_t align, size_t size) {
+    void* p = aligned_alloc(align, (size + align - 1) / align * align);
+    if (!p) {
+        fprintf(stderr, "failed to allocate %ld bytes memory!\n", size);
+        exit(1);
+    }
+    return p;
+}
+
+void bank_init(bank_t* bank, int n_accounts, layout_t layout, bank_mode_t mode) {
+    memset(bank, 0, sizeof(bank_t));
+    bank->layout = layout;
+    bank->mode = mode;
+    pthread_mutex_init(&bank->global, NULL);
+    clh_init(&bank->clh);
+    cohort_init(&bank->cohort, qlock_n_nodes(), COHORT_MAX_PASSES);
+    bank->n_accounts = n_accounts;
+    switch (layout) {
+    case LAYOUT_PACKED:
+        bank->packed = (account_t*)alloc_or_die(CACHE_LINE, n_accounts * sizeof(account_t));
+        for (int i = 0; i < n_accounts; ++i) {
+            bank->packed[i].aid = i;
+        }
+        break;
+    case LAYOUT_PADDED:
+        bank->padded = (padded_account_t*)alloc_or_die(CACHE_LINE, n_accounts * sizeof(padded_account_t));
+        for (int i = 0; i < n_accounts; ++i) {
+            bank->padded[i].aid = i;
+        }
+        break;
+    default:
+        bank->balances = (int*)alloc_or_die(CACHE_LINE, n_accounts * sizeof(int));
+        bank->locks = (padded_mutex_t*)alloc_or_die(CACHE_LINE, n_accounts * sizeof(padded_mutex_t));
+        break;
+    }
+    if (mode == MODE_SNAPSHOT || mode == MODE_OPTIMISTIC) {
+        bank->seqs = (unsigned*)alloc_or_die(CACHE_LINE, n_accounts * sizeof(unsigned));
+        memset(bank->seqs, 0, n_accounts * sizeof(unsigned));
+    }
+    for (int i = 0; i < n_accounts; ++i) {
+        *account_balance(bank, i) = INIT_BALANCE;
+        pthread_mutex_init(account_lock(bank, i), NULL);
+    }
+}
+
+void bank_destroy(bank_t* bank) {
+    pthread_mutex_destroy(&bank->global);
+    clh_destroy(&bank->clh);
+    cohort_destroy(&bank->cohort);
+    for (int i = 0; i < bank->n_accounts; ++i) {
+        pthread_mutex_destroy(account_lock(bank, i));
+    }
+    free(bank->packed);
+    free(bank->padded);
+    free(bank->balances);
+    free(bank->seqs);
+    free(bank->audit_ns);
+    free(bank->locks);
+    free(bank->requests);
+    free(bank->latency_ns);
+}
+
+long long bank_total(bank_t* bank) {
+    long long total = 0;
+    for (int i = 0; i < bank->n_accounts; ++i) {
+        total += *account_balance(bank, i);
+    }
+    return total;
+}
+
+/*---------------------------- zipf workload ----------------------------*/
+
+/*!
+ * \brief the CDF of a Zipf distribution with exponent `s` over `n`
+ * ranks; s = 0 is uniform. Rank i maps to account i, so the hot
+ * accounts are neighbors in the array.
+ */
+double* zipf_cdf(int n, double s) {
+    double* cdf = (double*)malloc(n * sizeof(double));
+    double sum = 0;
+    for (int i = 0; i < n; ++i) {
+        sum += 1.0 / pow(i + 1, s);
+        cdf[i] = sum;
+    }
+    for (int i = 0; i < n; ++i) {
+        cdf[i] /= sum;
+    }
+    return cdf;
+}
+
+int zipf_sample(const double* cdf, int n, uint64_t* state) {
+    double u = (next_rand(state) >> 11) * (1.0 / 9007199254740992.0);
+    int lo = 0, hi = n - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (cdf[mid] < u) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void gen_requests(bank_t* bank, size_t n_requests, double s) {
+    double* cdf = zipf_cdf(bank->n_accounts, s);
+    uint64_t state = 88172645463325252ull;
+
+    bank->n_requests = n_requests;
+    bank->requests = (transfer_req_t*)realloc(bank->requests, n_requests * sizeof(transfer_req_t));
+    bank->latency_ns = (uint64_t*)realloc(bank->latency_ns, n_requests * sizeof(uint64_t));
+    assert(bank->requests && bank->latency_ns);
+
+    for (size_t i = 0; i < n_requests; ++i) {
+        int from = zipf_sample(cdf, bank->n_accounts, &state);
+        int to;
+        do {
+            to = zipf_sample(cdf, bank->n_accounts, &state);
+        } while (to == from);
+        bank->requests[i].from = from;
+        bank->requests[i].to = to;
+        bank->requests[i].amount = next_rand(&state) % MAX_AMOUNT + 1;
+    }
+    free(cdf);
+}
+
+/*---------------------------- worker pool ----------------------------*/
+
+void* worker(void* arg) {
+    bank_t* bank = (bank_t*)arg;
+    backoff_seed = (unsigned int)pthread_self();
+    clh_handle_init(&clh_handle);
+    combiner_slot = __atomic_fetch_add(&bank->next_slot, 1, __ATOMIC_RELAXED);
+    batch_table_t table;
+    batch_table_init(&table);
+
+    while (1) {
+        size_t begin = __atomic_fetch_add(&bank->next, CLAIM_BATCH, __ATOMIC_RELAXED);
+        if (begin >= bank->n_requests) {
+            break;
+        }
+        size_t end = begin + CLAIM_BATCH < bank->n_requests ? begin + CLAIM_BATCH : bank->n_requests;
+
+        if (bank->mode == MODE_BATCH) {
+            // every transfer of the batch completes when the batch is applied
+            uint64_t start = now_ns();
+            transfer_batch(bank, &bank->requests[begin], end - begin, &table);
+            uint64_t latency = now_ns() - start;
+            for (size_t i = begin; i < end; ++i) {
+                bank->latency_ns[i] = latency;
+            }
+            continue;
+        }
+
+        for (size_t i = begin; i < end; ++i) {
+            uint64_t start = now_ns();
+            bank_transfer(bank, &bank->requests[i]);
+            bank->latency_ns[i] = now_ns() - start;
+        }
+    }
+    clh_handle_destroy(&clh_handle);
+    return NULL;
+}
+
+/* MODE_SNAPSHOT: take consistent totals back to back until the workers are done */
+void* auditor(void* arg) {
+    bank_t* bank = (bank_t*)arg;
+    unsigned* seqs = (unsigned*)malloc(bank->n_accounts * sizeof(unsigned));
+    assert(seqs);
+    const long long expected = (long long)bank->n_accounts * INIT_BALANCE;
+
+    while (!bank->stop_audit) {
+        uint64_t start = now_ns();
+        long long total = bank_snapshot_total(bank, seqs);
+        uint64_t latency = now_ns() - start;
+
+        /* a torn snapshot would see money in flight */
+        assert(total == expected);
+        if (bank->snapshots < AUDIT_SAMPLES) {
+            bank->audit_ns[bank->snapshots] = latency;
+        }
+        ++bank->snapshots;
+    }
+    free(seqs);
+    return NULL;
+}
+
+/*!
+ * \brief drain the request stream with `n_workers` threads and report
+ * transfers/sec and the p50/p99 service latency. In MODE_SNAPSHOT an
+ * auditor thread sums the balances meanwhile, compare the transfers/sec
+ * with MODE_MUTEX for the writer slowdown.
+ */
+void bank_run(bank_t* bank, int n_workers, double s) {
+    pthread_t workers[n_workers], audit;
+    long long total = bank_total(bank);
+
+    bank->next = 0;
+    bank->retries = bank->aborted = 0;
+    handoff_stats_init(&bank->handoffs);
+    bank->next_slot = 0;
+    fc_init(&bank->combiner, n_workers, apply_transfer, bank);
+    bank->stop_audit = 0;
+    bank->snapshots = bank->snapshot_retries = bank->snapshot_fallbacks = 0;
+    if (bank->mode == MODE_SNAPSHOT) {
+        bank->audit_ns = (uint64_t*)realloc(bank->audit_ns, AUDIT_SAMPLES * sizeof(uint64_t));
+        assert(bank->audit_ns);
+        assert( pthread_create(&audit, NULL, auditor, bank) == 0 );
+    }
+    uint64_t start = now_ns();
+    for (int i = 0; i < n_workers; ++i) {
+        if ( pthread_create(&workers[i], NULL, worker, bank) != 0 )
+        {
+            fprintf(stderr, "pthread_create failed.\n");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < n_workers; ++i) {
+        assert( pthread_join(workers[i], NULL) == 0 );
+    }
+    uint64_t elapsed = now_ns() - start;
+    if (bank->mode == MODE_SNAPSHOT) {
+        bank->stop_audit = 1;
+        assert( pthread_join(audit, NULL) == 0 );
+    }
+
+    /* the transfers move money around but never create or destroy it */
+    assert( bank_total(bank) == total );
+
+    qsort(bank->latency_ns, bank->n_requests, sizeof(uint64_t), cmp_u64);
+    printf("[%s/%s] accounts=%d workers=%d zipf=%.2f: %.0f transfers/s, p50 %lu ns, p99 %lu ns\n",
+           mode_names[bank->mode], layout_names[bank->layout], bank->n_accounts, n_workers, s, bank->n_requests * 1e9 / elapsed,
+           bank->latency_ns[bank->n_requests / 2], bank->latency_ns[bank->n_requests * 99 / 100]);
+    if (bank->mode == MODE_BACKOFF) {
+        printf("\tretries=%ld, aborted transfers=%ld\n", bank->retries, bank->aborted);
+    }
+    if (bank->mode == MODE_OPTIMISTIC) {
+        printf("\tretries=%ld\n", bank->retries);
+    }
+    if (bank->mode == MODE_SNAPSHOT && bank->snapshots > 0) {
+        long n = bank->snapshots < AUDIT_SAMPLES ? bank->snapshots : AUDIT_SAMPLES;
+        qsort(bank->audit_ns, n, sizeof(uint64_t), cmp_u64);
+        printf("\tsnapshots=%ld, p50 %lu ns, p99 %lu ns, retries=%ld, locked fallbacks=%ld\n",
+               bank->snapshots, bank->audit_ns[n / 2], bank->audit_ns[n * 99 / 100],
+               bank->snapshot_retries, bank->snapshot_fallbacks);
+    }
+    if (bank->mode == MODE_COMBINING) {
+        printf("\t%.2f transfers per combining pass\n", (double)bank->combiner.combined / bank->combiner.passes);
+    }
+    fc_destroy(&bank->combiner);
+    if (bank->mode >= MODE_GLOBAL && bank->mode <= MODE_COHORT) {
+        printf("\tcross-node handoffs=%ld of %ld\n", bank->handoffs.cross_node, bank->handoffs.acquisitions);
+    }
+}
+
+/*!
+ * \brief run one point, or sweep the workers from 1 to all cores when
+ * `n_workers` is 0
+ */
+void bench(bank_t* bank, size_t n_requests, int n_workers, double s) {
+    gen_requests(bank, n_requests, s);
+    if (n_workers > 0) {
+        bank_run(bank, n_workers, s);
+        return;
+    }
+    const int nprocs = get_nprocs();
+    for (int k = 1; ; k = k * 2 < nprocs ? k * 2 : nprocs) {
+        bank_run(bank, k, s);
+        if (k == nprocs) {
+            break;
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3 || argc == 4 || argc > 7) {
+        printf("Usage: %s <accounts> <transfers> [<workers> <zipf exponent> [<layout> [<mode>]]]\n"
+               "  layout: packed (default), padded or split\n"
+               "  mode: mutex (default), optimistic, batch, backoff, global, mcs, clh, cohort, combining or snapshot\n"
+               "Without the optional arguments, sweep the workers from 1 to all cores, "
+               "the exponent over 0, 0.5, 0.99 and 1.2, every mode and every layout.\n", argv[0]);
+        exit(1);
+    }
+    const int n_accounts = atoi(argv[1]);
+    const size_t n_requests = atol(argv[2]);
+    if (n_accounts < 2 || n_requests < 1) {
+        printf("Error: invalid arguments.\n");
+        exit(1);
+    }
+
+    if (argc >= 5) {
+        const int n_workers = atoi(argv[3]);
+        const double s = atof(argv[4]);
+        layout_t layout = argc >= 6 ? find_name(layout_names, N_LAYOUTS, argv[5]) : LAYOUT_PACKED;
+        bank_mode_t mode = argc >= 7 ? find_name(mode_names, N_MODES, argv[6]) : MODE_MUTEX;
+        if (n_workers < 1 || layout == N_LAYOUTS || mode == N_MODES) {
+            printf("Error: invalid arguments.\n");
+            exit(1);
+        }
+        bank_t bank;
+        bank_init(&bank, n_accounts, layout, mode);
+        bench(&bank, n_requests, n_workers, s);
+        bank_destroy(&bank);
+    } else {
+        const double skews[] = { 0, 0.5, 0.99, 1.2 };
+        for (int i = 0; i < sizeof(skews) / sizeof(skews[0]); ++i) {
+            for (bank_mode_t mode = 0; mode < N_MODES; ++mode) {
+                for (layout_t layout = 0; layout < N_LAYOUTS; ++layout) {
+                    bank_t bank;
+                    bank_init(&bank, n_accounts, layout, mode);
+                    bench(&bank, n_requests, 0, skews[i]);
+                    bank_destroy(&bank);
+                }
+            }
+        }
+    }
+
+    return 0;
+}
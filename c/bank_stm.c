@@ -0,0 +1,347 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+#include <sys/sysinfo.h>
+#include <time.h>
+
+#define INIT_BALANCE 1000
+#define MAX_AMOUNT 100
+#define MAX_LEGS 32
+#define CLAIM_BATCH 16    // transactions a worker claims at once
+#define BACKOFF_MIN_NS 64 // contention management: the first back-off after an abort
+#define BACKOFF_MAX_NS 65536
+
+/* one leg of a multi-account transaction, the deltas of all legs sum to 0 */
+typedef struct _leg_t {
+    int account;
+    int delta;
+} leg_t;
+
+typedef struct _txn_t {
+    int n_legs;
+    leg_t legs[MAX_LEGS];
+} txn_t;
+
+/*---------------------------- the account table ----------------------------*/
+
+typedef struct _bank_t {
+    int n_accounts;
+    long* balances;          // the transactional words
+    uint64_t* vlocks;        // STM: per-account versioned lock, version << 1 | locked
+    pthread_mutex_t* locks;  // mutex mode: per-account mutex
+    uint64_t clock;          // STM: the global version clock
+    txn_t* txns;             // the transactions to run
+    size_t n_txns;
+    size_t next;             // the next transaction to claim
+    long aborts;
+} bank_t;
+
+/*---------------------------- TL2-style word STM ----------------------------*/
+
+/*
+ * Reads are invisible: a read checks the account's versioned lock before
+ * and after loading the balance and aborts if the version is newer than
+ * the clock value the transaction started with. Writes are buffered and
+ * published at commit, which locks the written accounts (in aid order,
+ * never waiting), takes a new clock value, re-validates the reads and
+ * releases the locks with the new version.
+ */
+
+typedef struct _stm_tx_t {
+    bank_t* bank;
+    uint64_t rv;                   // clock value at start
+    int reads[MAX_LEGS];
+    int n_reads;
+    int write_accounts[MAX_LEGS];  // the write set, sorted by account at commit
+    long write_values[MAX_LEGS];
+    int n_writes;
+} stm_tx_t;
+
+#define LOCKED(v) ((v) & 1)
+#define VERSION(v) ((v) >> 1)
+
+void stm_begin(stm_tx_t* tx, bank_t* bank) {
+    tx->bank = bank;
+    tx->rv = __atomic_load_n(&bank->clock, __ATOMIC_ACQUIRE);
+    tx->n_reads = tx->n_writes = 0;
+}
+
+/* load a balance, returns 0 if the transaction must abort */
+int stm_read(stm_tx_t* tx, int account, long* value) {
+    for (int i = 0; i < tx->n_writes; ++i) {
+        if (tx->write_accounts[i] == account) {
+            *value = tx->write_values[i];
+            return 1;
+        }
+    }
+
+    uint64_t* vlock = &tx->bank->vlocks[account];
+    uint64_t pre = __atomic_load_n(vlock, __ATOMIC_ACQUIRE);
+    *value = __atomic_load_n(&tx->bank->balances[account], __ATOMIC_ACQUIRE);
+    uint64_t post = __atomic_load_n(vlock, __ATOMIC_ACQUIRE);
+    if (LOCKED(pre) || pre != post || VERSION(pre) > tx->rv) {
+        return 0;
+    }
+    tx->reads[tx->n_reads++] = account;
+    return 1;
+}
+
+void stm_write(stm_tx_t* tx, int account, long value) {
+    for (int i = 0; i < tx->n_writes; ++i) {
+        if (tx->write_accounts[i] == account) {
+            tx->write_values[i] = value;
+            return;
+        }
+    }
+    tx->write_accounts[tx->n_writes] = account;
+    tx->write_values[tx->n_writes++] = value;
+}
+
+static void stm_unlock_writes(stm_tx_t* tx, int n, int has_version, uint64_t wv) {
+    for (int i = 0; i < n; ++i) {
+        uint64_t* vlock = &tx->bank->vlocks[tx->write_accounts[i]];
+        uint64_t v = has_version ? wv << 1 : __atomic_load_n(vlock, __ATOMIC_RELAXED) & ~1ull;
+        __atomic_store_n(vlock, v, __ATOMIC_RELEASE);
+    }
+}
+
+/* publish the writes, returns 0 if the transaction must abort */
+int stm_commit(stm_tx_t* tx) {
+    bank_t* bank = tx->bank;
+
+    // lock the write set in account order; a lock held by another commit aborts
+    for (int i = 1; i < tx->n_writes; ++i) {
+        for (int j = i; j > 0 && tx->write_accounts[j - 1] > tx->write_accounts[j]; --j) {
+            int a = tx->write_accounts[j]; tx->write_accounts[j] = tx->write_accounts[j - 1]; tx->write_accounts[j - 1] = a;
+            long v = tx->write_values[j]; tx->write_values[j] = tx->write_values[j - 1]; tx->write_values[j - 1] = v;
+        }
+    }
+    for (int i = 0; i < tx->n_writes; ++i) {
+        uint64_t* vlock = &bank->vlocks[tx->write_accounts[i]];
+        uint64_t v = __atomic_load_n(vlock, __ATOMIC_RELAXED);
+        if (LOCKED(v) || VERSION(v) > tx->rv ||
+            !__atomic_compare_exchange_n(vlock, &v, v | 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            stm_unlock_writes(tx, i, 0, 0);
+            return 0;
+        }
+    }
+
+    uint64_t wv = __atomic_add_fetch(&bank->clock, 1, __ATOMIC_ACQ_REL);
+
+    // no other commit since the start: the reads are still valid
+    if (wv != tx->rv + 1) {
+        for (int i = 0; i < tx->n_reads; ++i) {
+            int account = tx->reads[i];
+            uint64_t v = __atomic_load_n(&bank->vlocks[account], __ATOMIC_ACQUIRE);
+            int own = 0;
+            for (int j = 0; j < tx->n_writes && !own; ++j) {
+                own = tx->write_accounts[j] == account;
+            }
+            if ((LOCKED(v) && !own) || VERSION(v) > tx->rv) {
+                stm_unlock_writes(tx, tx->n_writes, 0, 0);
+                return 0;
+            }
+        }
+    }
+
+    for (int i = 0; i < tx->n_writes; ++i) {
+        __atomic_store_n(&bank->balances[tx->write_accounts[i]], tx->write_values[i], __ATOMIC_RELEASE);
+    }
+    stm_unlock_writes(tx, tx->n_writes, 1, wv);
+    return 1;
+}
+
+/*!
+ * \brief run the legs of `txn` as one transaction, retrying with an
+ * exponential, jittered back-off after every abort
+ */
+void txn_stm(bank_t* bank, const txn_t* txn, unsigned int* seed) {
+    long backoff_ns = BACKOFF_MIN_NS;
+    stm_tx_t tx;
+
+    while (1) {
+        stm_begin(&tx, bank);
+        int ok = 1;
+        for (int i = 0; i < txn->n_legs && ok; ++i) {
+            long balance;
+            ok = stm_read(&tx, txn->legs[i].account, &balance);
+            if (ok) {
+                stm_write(&tx, txn->legs[i].account, balance + txn->legs[i].delta);
+            }
+        }
+        if (ok && stm_commit(&tx)) {
+            return;
+        }
+
+        __atomic_fetch_add(&bank->aborts, 1, __ATOMIC_RELAXED);
+        struct timespec pause = { 0, rand_r(seed) % backoff_ns };
+        nanosleep(&pause, NULL);
+        backoff_ns = backoff_ns * 2 < BACKOFF_MAX_NS ? backoff_ns * 2 : BACKOFF_MAX_NS;
+    }
+}
+
+/*---------------------------- ordered mutexes ----------------------------*/
+
+int cmp_leg(const void* a, const void* b) {
+    return ((const leg_t*)a)->account - ((const leg_t*)b)->account;
+}
+
+/* the `transfer` of bank.c for N legs: lock every account in aid order */
+void txn_mutex(bank_t* bank, const txn_t* txn) {
+    leg_t legs[MAX_LEGS];
+    memcpy(legs, txn->legs, txn->n_legs * sizeof(leg_t));
+    qsort(legs, txn->n_legs, sizeof(leg_t), cmp_leg);
+
+    for (int i = 0; i < txn->n_legs; ++i) {
+        pthread_mutex_lock(&bank->locks[legs[i].account]);
+    }
+    for (int i = 0; i < txn->n_legs; ++i) {
+        bank->balances[legs[i].account] += legs[i].delta;
+    }
+    for (int i = txn->n_legs - 1; i >= 0; --i) {
+        pthread_mutex_unlock(&bank->locks[legs[i].account]);
+    }
+}
+
+/*---------------------------- benchmark ----------------------------*/
+
+static int use_stm;
+
+void* worker(void* arg) {
+    bank_t* bank = (bank_t*)arg;
+    unsigned int seed = (unsigned int)pthread_self();
+
+    while (1) {
+        size_t begin = __atomic_fetch_add(&bank->next, CLAIM_BATCH, __ATOMIC_RELAXED);
+        if (begin >= bank->n_txns) {
+            break;
+        }
+        size_t end = begin + CLAIM_BATCH < bank->n_txns ? begin + CLAIM_BATCH : bank->n_txns;
+        for (size_t i = begin; i < end; ++i) {
+            if (use_stm) {
+                txn_stm(bank, &bank->txns[i], &seed);
+            } else {
+                txn_mutex(bank, &bank->txns[i]);
+            }
+        }
+    }
+    return NULL;
+}
+
+/* `n_legs` distinct accounts, chosen uniformly, with deltas that sum to 0 */
+void gen_txns(bank_t* bank, size_t n_txns, int n_legs) {
+    unsigned int seed = 12345;
+    bank->n_txns = n_txns;
+    bank->txns = (txn_t*)realloc(bank->txns, n_txns * sizeof(txn_t));
+    assert(bank->txns);
+
+    for (size_t t = 0; t < n_txns; ++t) {
+        txn_t* txn = &bank->txns[t];
+        int sum = 0;
+        txn->n_legs = n_legs;
+        for (int i = 0; i < n_legs; ++i) {
+            int account, dup;
+            do {
+                account = rand_r(&seed) % bank->n_accounts;
+                dup = 0;
+                for (int j = 0; j < i; ++j) {
+                    dup |= txn->legs[j].account == account;
+                }
+            } while (dup);
+            txn->legs[i].account = account;
+            txn->legs[i].delta = i < n_legs - 1 ? rand_r(&seed) % (2 * MAX_AMOUNT + 1) - MAX_AMOUNT : -sum;
+            sum += txn->legs[i].delta;
+        }
+    }
+}
+
+void run(bank_t* bank, int n_workers, int n_legs) {
+    pthread_t workers[n_workers];
+    struct timespec start, end;
+
+    long total = 0;
+    for (int i = 0; i < bank->n_accounts; ++i) {
+        total += bank->balances[i];
+    }
+
+    bank->next = 0;
+    bank->aborts = 0;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+    for (int i = 0; i < n_workers; ++i) {
+        if ( pthread_create(&workers[i], NULL, worker, bank) != 0 )
+        {
+            fprintf(stderr, "pthread_create failed.\n");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < n_workers; ++i) {
+        assert( pthread_join(workers[i], NULL) == 0 );
+    }
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+
+    /* conservation: every transaction moves money without creating any */
+    for (int i = 0; i < bank->n_accounts; ++i) {
+        total -= bank->balances[i];
+    }
+    assert(total == 0);
+
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    printf("[%s] accounts=%d workers=%d legs=%d: %.0f txns/s, %.3f aborts/txn\n",
+           use_stm ? "stm" : "mutex", bank->n_accounts, n_workers, n_legs,
+           bank->n_txns / elapsed, (double)bank->aborts / bank->n_txns);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 3 && argc != 4) {
+        printf("Usage: %s <accounts> <transactions> [<workers>]\n"
+               "Run 2, 4, 8 and 16-leg transactions with the STM and with ordered mutexes; "
+               "fewer accounts mean more contention. Without <workers>, sweep from 1 to all cores.\n",
+               argv[0]);
+        exit(1);
+    }
+    const int n_accounts = atoi(argv[1]);
+    const size_t n_txns = atol(argv[2]);
+    const int workers = argc == 4 ? atoi(argv[3]) : 0;
+    if (n_accounts < MAX_LEGS || n_txns < 1 || workers < 0) {
+        printf("Error: invalid arguments (at least %d accounts).\n", MAX_LEGS);
+        exit(1);
+    }
+
+    bank_t bank;
+    memset(&bank, 0, sizeof(bank));
+    bank.n_accounts = n_accounts;
+    bank.balances = (long*)malloc(n_accounts * sizeof(long));
+    bank.vlocks = (uint64_t*)calloc(n_accounts, sizeof(uint64_t));
+    bank.locks = (pthread_mutex_t*)malloc(n_accounts * sizeof(pthread_mutex_t));
+    assert(bank.balances && bank.vlocks && bank.locks);
+    for (int i = 0; i < n_accounts; ++i) {
+        bank.balances[i] = INIT_BALANCE;
+        pthread_mutex_init(&bank.locks[i], NULL);
+    }
+
+    const int nprocs = get_nprocs();
+    for (int n_legs = 2; n_legs <= 16; n_legs *= 2) {
+        gen_txns(&bank, n_txns, n_legs);
+        for (int k = workers ? workers : 1; ; k = k * 2 < nprocs ? k * 2 : nprocs) {
+            for (use_stm = 0; use_stm < 2; ++use_stm) {
+                run(&bank, k, n_legs);
+            }
+            if (workers || k == nprocs) {
+                break;
+            }
+        }
+    }
+
+    for (int i = 0; i < n_accounts; ++i) {
+        pthread_mutex_destroy(&bank.locks[i]);
+    }
+    free(bank.balances);
+    free(bank.vlocks);
+    free(bank.locks);
+    free(bank.txns);
+    return 0;
+}
@@ -0,0 +1,95 @@
+/*
+ * Flat combining (Hendler, Incze, Shavit and Tzafrir): instead of every
+ * thread taking the lock for its own operation, threads publish their
+ * operation in a per-thread slot, and whichever thread gets the lock
+ * applies all the published operations in one pass. The data stays in
+ * the combiner's cache and a contended handoff becomes a batch.
+ */
+#ifndef COMBINING_H
+#define COMBINING_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <assert.h>
+
+#ifndef CACHE_LINE
+#define CACHE_LINE 64
+#endif
+
+#define FC_SPIN_LIMIT 1024 // spins on the own slot before yielding the CPU
+
+/* applies one published operation, called by the combiner only */
+typedef void (*fc_apply_t)(void* ctx, void* op);
+
+typedef struct _fc_slot_t {
+    void* op;    // the published operation, owned by the publisher
+    int pending; // 1 from publishing until the combiner applied `op`
+} __attribute__((aligned(CACHE_LINE))) fc_slot_t;
+
+typedef struct _fc_t {
+    int lock __attribute__((aligned(CACHE_LINE)));
+    fc_apply_t apply;
+    void* ctx;
+    fc_slot_t* slots;
+    int n_slots;
+    long passes;   // combining passes, updated by the combiner
+    long combined; // operations applied by those passes
+} fc_t;
+
+static inline void fc_init(fc_t* fc, int n_slots, fc_apply_t apply, void* ctx) {
+    fc->lock = 0;
+    fc->apply = apply;
+    fc->ctx = ctx;
+    fc->slots = (fc_slot_t*)aligned_alloc(CACHE_LINE, n_slots * sizeof(fc_slot_t));
+    assert(fc->slots);
+    memset(fc->slots, 0, n_slots * sizeof(fc_slot_t));
+    fc->n_slots = n_slots;
+    fc->passes = 0;
+    fc->combined = 0;
+}
+
+static inline void fc_destroy(fc_t* fc) {
+    free(fc->slots);
+}
+
+/* apply every pending operation, the caller holds `fc->lock` */
+static inline void fc_combine(fc_t* fc) {
+    ++fc->passes;
+    for (int i = 0; i < fc->n_slots; ++i) {
+        fc_slot_t* s = &fc->slots[i];
+        if (__atomic_load_n(&s->pending, __ATOMIC_ACQUIRE)) {
+            fc->apply(fc->ctx, s->op);
+            ++fc->combined;
+            __atomic_store_n(&s->pending, 0, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+/*!
+ * \brief publish `op` in slot `slot` (one slot per thread) and return
+ * once it has been applied, by this thread or by another combiner
+ */
+static inline void fc_execute(fc_t* fc, int slot, void* op) {
+    fc_slot_t* s = &fc->slots[slot];
+    s->op = op;
+    __atomic_store_n(&s->pending, 1, __ATOMIC_RELEASE);
+
+    int spins = 0;
+    while (__atomic_load_n(&s->pending, __ATOMIC_ACQUIRE)) {
+        if (__atomic_load_n(&fc->lock, __ATOMIC_RELAXED) == 0 &&
+            __atomic_exchange_n(&fc->lock, 1, __ATOMIC_ACQUIRE) == 0) {
+            fc_combine(fc);
+            __atomic_store_n(&fc->lock, 0, __ATOMIC_RELEASE);
+        } else if (++spins == FC_SPIN_LIMIT) {
+            sched_yield();
+            spins = 0;
+        } else {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+    }
+}
+
+#endif /* COMBINING_H */
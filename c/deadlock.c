@@ -1,9 +1,23 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <assert.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "util.h"
+
+#define BACKOFF_TIMEOUT_NS 10000000 // how long to wait for the second lock
+#define BACKOFF_MIN_NS 1000         // the first back-off, doubled after every failure
+#define BACKOFF_MAX_NS 1000000
+#define BACKOFF_MAX_ATTEMPTS 64     // give the transfer up after so many attempts
+
+#ifndef LOCKDEP
+#define LOCKDEP 0 // `make deadlock LOCKDEP=1` to build with the lock-order checker
+#endif
+
 typedef struct _account_t {
     int balance;
     pthread_mutex_t m;
@@ -16,20 +30,242 @@ typedef struct _transfer_args_t {
     int amount;
 } transfer_arg_t;
 
+/*---------------------------- lock-order checker ----------------------------*/
+
+#if LOCKDEP
+#define LOCKDEP_MAX_HELD 16   // locks one thread may hold at the same time
+#define LOCKDEP_MAX_EDGES 1024
+#define LOCKDEP_MAX_NODES (2 * LOCKDEP_MAX_EDGES)
+#define LOCKDEP_CACHE 64      // edges each thread remembers as already recorded
+
+typedef struct _lockdep_held_t {
+    pthread_mutex_t* m;
+    int id;
+    const char* site;
+} lockdep_held_t;
+
+/* "`to` was acquired at `to_site` while holding `from`, acquired at `from_site`" */
+typedef struct _lockdep_edge_t {
+    pthread_mutex_t* from;
+    pthread_mutex_t* to;
+    int from_node, to_node; // in `nodes`
+    int from_id, to_id;
+    const char* from_site;
+    const char* to_site;
+} lockdep_edge_t;
+
+/* per-thread state: the held locks and the edges known to be in the graph */
+static __thread lockdep_held_t held[LOCKDEP_MAX_HELD];
+static __thread int n_held = 0;
+static __thread lockdep_edge_t known[LOCKDEP_CACHE];
+static __thread int n_known = 0;
+
+/* the global lock-order graph, only locked when a thread sees a new edge */
+static pthread_mutex_t graph_lock = PTHREAD_MUTEX_INITIALIZER;
+static lockdep_edge_t edges[LOCKDEP_MAX_EDGES];
+static int n_edges = 0;
+static pthread_mutex_t* nodes[LOCKDEP_MAX_NODES]; // the locks that have an edge
+static int n_nodes = 0;
+static int graph_full = 0; // LOCKDEP_MAX_EDGES reached, the checking is off
+
+/* the node of `m`, added if `add` is set; -1 if it has none */
+static int lockdep_node(pthread_mutex_t* m, int add) {
+    for (int i = 0; i < n_nodes; ++i) {
+        if (nodes[i] == m) {
+            return i;
+        }
+    }
+    if (!add) {
+        return -1;
+    }
+    nodes[n_nodes] = m;
+    return n_nodes++;
+}
+
+/*!
+ * \brief breadth-first search for the shortest path `from` -> ... -> `to`,
+ * the edges on it go to `path`. Every node is visited at most once, so
+ * every edge is followed at most once, however long the path.
+ *
+ * \return the edges on the path, 0 if there is none
+ */
+static int lockdep_find_path(int from, int to, int* path) {
+    static uint64_t visited[(LOCKDEP_MAX_NODES + 63) / 64];
+    static int queue[LOCKDEP_MAX_NODES];
+    static int via[LOCKDEP_MAX_NODES]; // the edge a node was reached by
+    if (from < 0 || to < 0) {
+        return 0;
+    }
+
+    memset(visited, 0, sizeof(visited));
+    visited[from / 64] |= 1ull << from % 64;
+    int head = 0, tail = 0;
+    queue[tail++] = from;
+    while (head < tail) {
+        const int node = queue[head++];
+        for (int i = 0; i < n_edges; ++i) {
+            const int next = edges[i].to_node;
+            if (edges[i].from_node != node || visited[next / 64] >> next % 64 & 1) {
+                continue;
+            }
+            visited[next / 64] |= 1ull << next % 64;
+            via[next] = i;
+            if (next != to) {
+                queue[tail++] = next;
+                continue;
+            }
+            int len = 0;
+            for (int n = to; n != from; n = edges[via[n]].from_node) {
+                ++len;
+            }
+            for (int n = to, k = len; n != from; n = edges[via[n]].from_node) {
+                path[--k] = via[n];
+            }
+            return len;
+        }
+    }
+    return 0;
+}
+
+static void lockdep_add_edge(const lockdep_held_t* h, pthread_mutex_t* m, int id, const char* site) {
+    for (int i = 0; i < n_known; ++i) {
+        if (known[i].from == h->m && known[i].to == m) {
+            return;
+        }
+    }
+
+    if (__atomic_load_n(&graph_full, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    pthread_mutex_lock(&graph_lock);
+    int found = 0;
+    for (int i = 0; i < n_edges && !found; ++i) {
+        found = edges[i].from == h->m && edges[i].to == m;
+    }
+    if (!found && n_edges == LOCKDEP_MAX_EDGES) {
+        // a graph without this edge would miss the inversions through it
+        if (!graph_full) {
+            fprintf(stderr, "lockdep: graph full (%d edges), checking disabled\n", LOCKDEP_MAX_EDGES);
+            __atomic_store_n(&graph_full, 1, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&graph_lock);
+        return;
+    }
+    if (!found) {
+        // a path back from `m` to the held lock closes a cycle with the new edge
+        int path[LOCKDEP_MAX_EDGES];
+        int len = lockdep_find_path(lockdep_node(m, 0), lockdep_node(h->m, 0), path);
+        if (len) {
+            fprintf(stderr, "lockdep: lock order inversion, possible deadlock\n");
+            fprintf(stderr, "  now:    account %d (held since %s) -> account %d (requested at %s)\n",
+                    h->id, h->site, id, site);
+            for (int i = 0; i < len; ++i) {
+                const lockdep_edge_t* e = &edges[path[i]];
+                fprintf(stderr, "  before: account %d (held since %s) -> account %d (requested at %s)\n",
+                        e->from_id, e->from_site, e->to_id, e->to_site);
+            }
+        }
+        edges[n_edges++] = (lockdep_edge_t){ h->m, m, lockdep_node(h->m, 1), lockdep_node(m, 1),
+                                             h->id, id, h->site, site };
+    }
+    pthread_mutex_unlock(&graph_lock);
+
+    // only an edge that is in the graph may skip the graph next time
+    if (n_known < LOCKDEP_CACHE) {
+        known[n_known++] = (lockdep_edge_t){ h->m, m, -1, -1, h->id, id, h->site, site };
+    }
+}
+
+/*!
+ * \brief pthread_mutex_lock that records the lock order. Every lock this
+ * thread already holds gets an edge to `m` in the global graph, and a
+ * cycle is reported before blocking, i.e. the first time an inversion
+ * is seen rather than when it actually deadlocks.
+ */
+void lockdep_lock(pthread_mutex_t* m, int id, const char* site) {
+    for (int i = 0; i < n_held; ++i) {
+        lockdep_add_edge(&held[i], m, id, site);
+    }
+    pthread_mutex_lock(m);
+    assert(n_held < LOCKDEP_MAX_HELD);
+    held[n_held++] = (lockdep_held_t){ m, id, site };
+}
+
+void lockdep_unlock(pthread_mutex_t* m) {
+    for (int i = n_held - 1; i >= 0; --i) {
+        if (held[i].m == m) {
+            held[i] = held[--n_held];
+            break;
+        }
+    }
+    pthread_mutex_unlock(m);
+}
+
+#define LOCKDEP_STR(x) #x
+#define LOCKDEP_SITE(file, line) file ":" LOCKDEP_STR(line)
+#define account_lock(acct) lockdep_lock(&(acct)->m, (acct)->aid, LOCKDEP_SITE(__FILE__, __LINE__))
+#define account_unlock(acct) lockdep_unlock(&(acct)->m)
+#else
+#define account_lock(acct) pthread_mutex_lock(&(acct)->m)
+#define account_unlock(acct) pthread_mutex_unlock(&(acct)->m)
+#endif
+
 void* deadlock_transfer(void *arg) {
     transfer_arg_t* tran = (transfer_arg_t*)(arg);
 
     printf("%d -> %d transfer $%d\n", tran->from->aid, tran->to->aid, tran->amount);
 
-    pthread_mutex_lock(&tran->from->m);
+    account_lock(tran->from);
     sleep(1);
-    pthread_mutex_lock(&tran->to->m);
+    account_lock(tran->to);
 
     tran->from->balance -= tran->amount;
     tran->to->balance += tran->amount;
 
-    pthread_mutex_unlock(&tran->to->m);
-    pthread_mutex_unlock(&tran->from->m);
+    account_unlock(tran->to);
+    account_unlock(tran->from);
+    return NULL;
+}
+
+static int retries = 0; // attempts that released the first lock and started over
+static int aborted = 0; // transfers given up after BACKOFF_MAX_ATTEMPTS
+
+/*!
+ * \brief deadlock_transfer that does not hang: the locks are still taken
+ * in from/to order, but the second one only with a timeout. On timeout
+ * the first lock is released, and the thread backs off for a random time
+ * below an exponentially growing bound before it tries again, so the two
+ * threads of an ABBA pair stop colliding.
+ */
+void* backoff_transfer(void *arg) {
+    transfer_arg_t* tran = (transfer_arg_t*)(arg);
+    unsigned int seed = (unsigned int)(size_t)arg;
+    long backoff_ns = BACKOFF_MIN_NS;
+
+    printf("%d -> %d transfer $%d\n", tran->from->aid, tran->to->aid, tran->amount);
+
+    for (int attempt = 0; attempt < BACKOFF_MAX_ATTEMPTS; ++attempt) {
+        pthread_mutex_lock(&tran->from->m);
+        if (attempt == 0) {
+            sleep(1); // the same window as deadlock_transfer
+        }
+        if (timed_lock(&tran->to->m, BACKOFF_TIMEOUT_NS) == 0) {
+            tran->from->balance -= tran->amount;
+            tran->to->balance += tran->amount;
+
+            pthread_mutex_unlock(&tran->to->m);
+            pthread_mutex_unlock(&tran->from->m);
+            return NULL;
+        }
+        pthread_mutex_unlock(&tran->from->m);
+        __atomic_fetch_add(&retries, 1, __ATOMIC_RELAXED);
+
+        struct timespec pause = { 0, rand_r(&seed) % backoff_ns };
+        nanosleep(&pause, NULL);
+        backoff_ns = backoff_ns * 2 < BACKOFF_MAX_NS ? backoff_ns * 2 : BACKOFF_MAX_NS;
+    }
+    __atomic_fetch_add(&aborted, 1, __ATOMIC_RELAXED);
     return NULL;
 }
 
@@ -43,6 +279,12 @@ void create_account(account_t* acct, int balance) {
 int main(int argc, char* argv[]) {
     pthread_t p1, p2;
 
+    /* `./deadlock backoff` runs the transfers that back off instead of hanging */
+    void* (*routine)(void*) = deadlock_transfer;
+    if (argc == 2 && strcmp(argv[1], "backoff") == 0) {
+        routine = backoff_transfer;
+    }
+
     /* create two accounts */
     account_t a1, a2;
     create_account(&a1, 1000);
@@ -61,12 +303,12 @@ int main(int argc, char* argv[]) {
     arg2.amount = 100;
 
     /* apply the two transactions */
-    if ( pthread_create(&p1, NULL, deadlock_transfer, &arg1) != 0 )
+    if ( pthread_create(&p1, NULL, routine, &arg1) != 0 )
     {
         fprintf(stderr, "pthread_create failed.\n");
         exit(1);
     }
-    if ( pthread_create(&p2, NULL, deadlock_transfer, &arg2) != 0 )
+    if ( pthread_create(&p2, NULL, routine, &arg2) != 0 )
     {
         fprintf(stderr, "pthread_create failed.\n");
         exit(1);
@@ -75,6 +317,9 @@ int main(int argc, char* argv[]) {
     assert( pthread_join(p2, NULL) == 0 );
 
     printf("main end: a1's balance=%d, a2's balance=%d\n", a1.balance, a2.balance);
+    if (routine == backoff_transfer) {
+        printf("retries=%d, aborted transfers=%d\n", retries, aborted);
+    }
 
     pthread_mutex_destroy(&a1.m);
     pthread_mutex_destroy(&a2.m);
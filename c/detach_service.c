@@ -0,0 +1,161 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "service.h"
+#include "util.h"
+
+#define MIN_PERIOD_MS 10
+#define N_PERIODS 100         // task i runs every MIN_PERIOD_MS * (1 + i % N_PERIODS)
+#define SLACK_NS 1000000      // 1 ms
+
+/* what one periodic task does: count its calls */
+typedef struct _tick_t {
+    long calls;
+    int drained;
+} tick_t;
+
+/* the detach.c way: one detached thread per task, sleeping between calls */
+typedef struct _sleepers_t {
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t exited;
+    int live;
+    long wakeups;
+} sleepers_t;
+
+typedef struct _sleeper_arg_t {
+    sleepers_t* sleepers;
+    tick_t* tick;
+    uint64_t period_ns;
+} sleeper_arg_t;
+
+uint64_t period_of(int i) {
+    return (uint64_t)MIN_PERIOD_MS * (1 + i % N_PERIODS) * 1000000;
+}
+
+int tick(void* arg, int stopping) {
+    tick_t* t = (tick_t*)arg;
+    if (stopping) {
+        t->drained = 1;
+    } else {
+        ++t->calls;
+    }
+    return 0;
+}
+
+/*!
+ * \brief `func` of detach.c with a stop flag: it is only seen after the
+ * sleep, so the shutdown waits up to a whole period
+ */
+void* sleeper(void* arg) {
+    sleeper_arg_t* a = (sleeper_arg_t*)arg;
+    sleepers_t* s = a->sleepers;
+    struct timespec ts = { a->period_ns / 1000000000ull, a->period_ns % 1000000000ull };
+    long wakeups = 0;
+    while (1) {
+        nanosleep(&ts, NULL);
+        ++wakeups;
+        if (__atomic_load_n(&s->stop, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        tick(a->tick, 0);
+    }
+    pthread_mutex_lock(&s->lock);
+    s->wakeups += wakeups;
+    if (--s->live == 0) {
+        pthread_cond_broadcast(&s->exited);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+long total_calls(tick_t* ticks, int n) {
+    long calls = 0;
+    for (int i = 0; i < n; ++i) {
+        calls += ticks[i].calls;
+    }
+    return calls;
+}
+
+void run_service(tick_t* ticks, int n, int n_workers, int seconds) {
+    service_t svc;
+    service_init(&svc, n_workers, SLACK_NS);
+    for (int i = 0; i < n; ++i) {
+        service_add(&svc, period_of(i), tick, &ticks[i]);
+    }
+    sleep(seconds);
+
+    uint64_t start = now_ns();
+    service_shutdown(&svc, 1);
+    uint64_t shutdown = now_ns() - start;
+    for (int i = 0; i < n; ++i) {
+        assert(ticks[i].drained);
+    }
+    printf("[service] tasks=%d workers=%d: %.0f calls/s, %.0f wakeups/s, shutdown+drain %.3f ms\n",
+           n, n_workers, (double)total_calls(ticks, n) / seconds, (double)svc.wakeups / seconds, shutdown / 1e6);
+}
+
+void run_sleepers(tick_t* ticks, int n, int seconds) {
+    sleepers_t s = { 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0 };
+    sleeper_arg_t* args = (sleeper_arg_t*)malloc(n * sizeof(sleeper_arg_t));
+    assert(args);
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    assert( pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) == 0 );
+    assert( pthread_attr_setstacksize(&attr, 64 * 1024) == 0 );
+    for (int i = 0; i < n; ++i) {
+        args[i].sleepers = &s;
+        args[i].tick = &ticks[i];
+        args[i].period_ns = period_of(i);
+        pthread_t t;
+        assert( pthread_create(&t, &attr, sleeper, &args[i]) == 0 );
+        ++s.live; // nobody exits before the stop
+    }
+    pthread_attr_destroy(&attr);
+    sleep(seconds);
+
+    uint64_t start = now_ns();
+    __atomic_store_n(&s.stop, 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&s.lock);
+    while (s.live > 0) {
+        pthread_cond_wait(&s.exited, &s.lock);
+    }
+    pthread_mutex_unlock(&s.lock);
+    uint64_t shutdown = now_ns() - start;
+    printf("[sleep] tasks=%d threads=%d: %.0f calls/s, %.0f wakeups/s, shutdown %.3f ms\n",
+           n, n, (double)total_calls(ticks, n) / seconds, (double)s.wakeups / seconds, shutdown / 1e6);
+    free(args);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 4) {
+        printf("Usage: %s [<tasks> [<workers> [<seconds>]]]\n"
+               "Run <tasks> periodic tasks (periods %d to %d ms) for <seconds> on <workers> service "
+               "threads, then on one detached sleeping thread each like detach.c, and report the "
+               "wakeups/s and the time to shut down.\n", argv[0], MIN_PERIOD_MS, MIN_PERIOD_MS * N_PERIODS);
+        exit(1);
+    }
+    const int n = argc >= 2 ? atoi(argv[1]) : 1000;
+    const int n_workers = argc >= 3 ? atoi(argv[2]) : 2;
+    const int seconds = argc == 4 ? atoi(argv[3]) : 3;
+    if (n < 1 || n_workers < 1 || seconds < 1) {
+        printf("Error: invalid arguments.\n");
+        exit(1);
+    }
+
+    tick_t* ticks = (tick_t*)calloc(n, sizeof(tick_t));
+    assert(ticks);
+    run_service(ticks, n, n_workers, seconds);
+    for (int i = 0; i < n; ++i) {
+        ticks[i].calls = 0;
+    }
+    run_sleepers(ticks, n, seconds);
+    free(ticks);
+    return 0;
+}
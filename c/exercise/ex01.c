@@ -1,9 +1,15 @@
 #define _GNU_SOURCE
 #include <assert.h>
+#include <math.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/syscall.h>
 #include <sys/sysinfo.h>
 #include <time.h>
@@ -11,16 +17,50 @@
 #include <numa.h>
 #include <numaif.h>
 
+#include "../trace.h"
+
 #define C_MEMCPY "C library: memcpy"
 #define SINGLE_THREAD "Singlethreading"
 #define MULTI_THREAD "Multithreading"
 #define MULTI_AFFINITY "Multithreading with affinity"
+#define MULTI_FIRST_TOUCH "Multithreading with parallel first-touch"
+#define MOVE_REMAP "Zero-copy move with mremap"
 #define MEM_LOCAL "Multithreading with numa_alloc_local"
 #define MEM_INTER "Multithreading with numa_alloc_interleaved"
+#define MEM_CROSS "Multithreading with a cross-node pipeline"
+
+/* page options for the source and target buffers */
+#define PAGE_4K "4k"   // malloc / numa_alloc_*, regular pages
+#define PAGE_THP "thp" // transparent huge pages, madvise(MADV_HUGEPAGE)
+#define PAGE_2M "2m"   // explicit 2 MB hugetlbfs pages
+#define PAGE_1G "1g"   // explicit 1 GB hugetlbfs pages
 
 #define PRINT_AFFINITY 1
 #define WARMUP 1
 
+#define MOVE_MIN_BYTES (256UL << 10) // smaller moves are copied, remapping does not pay off
+#define MOVE_PATTERN 0x5a           // the byte populate() fills `src` with
+
+/* parameters of the cross-node pipeline (MEM_CROSS) */
+#define CROSS_CHUNK (64UL << 10) // bytes per hand-off between a reader and a writer
+#define CROSS_SLOTS 8            // chunks per ring, i.e. 512 KB of staging per pair
+#ifndef PRINT_FAULT_SPLIT
+#define PRINT_FAULT_SPLIT 0 // `make SPLIT=1` to print the page fault / copy time split
+#endif
+
+/* parameters of the `--sweep` mode */
+#define SWEEP_MIN_BYTES (4UL << 10)   // 4 KB
+#define SWEEP_MAX_BYTES (4UL << 30)   // 4 GB, can be overridden on the command line
+#define SWEEP_MIN_REPEAT 5
+#define SWEEP_MAX_REPEAT 100
+#define SWEEP_REL_CI 0.02             // stop once the 95% CI is within 2% of the mean
+
+/* affinity messages are turned off in the sweep mode to keep the output parseable */
+static int print_affinity = PRINT_AFFINITY;
+
+/* one of the PAGE_* options, selected on the command line */
+static const char* page_option = PAGE_4K;
+
 /* You may need to define struct here */
 typedef struct {
   const void* src; // the address of the source whole buffer
@@ -39,18 +79,31 @@ void *mt_memcpy(void *arg) {
   MtMemcpyArg* mt_memcpy_arg = (MtMemcpyArg*) arg;
 
 #if PRINT_AFFINITY
-  int cpu, node;
-  int err = syscall(SYS_getcpu, &cpu, &node);
-  assert(!err);
-  printf("thread %d runs on cpu %d, NUMA node %d\n", mt_memcpy_arg->rank, cpu, node);
+  if (print_affinity) {
+    int cpu, node;
+    int err = syscall(SYS_getcpu, &cpu, &node);
+    assert(!err);
+    printf("thread %d runs on cpu %d, NUMA node %d\n", mt_memcpy_arg->rank, cpu, node);
+  }
 #endif
 
   // the starting address of the part that this thread should copy
   const void* src = mt_memcpy_arg->src + mt_memcpy_arg->size * mt_memcpy_arg->rank;
   void* dst = mt_memcpy_arg->dst + mt_memcpy_arg->size * mt_memcpy_arg->rank;
 
+#if TRACE
+  // call the single thread function to copy the part of this thread,
+  // a block at a time for the trace samples
+  trace_point("copy");
+  for (size_t offset = 0; offset < mt_memcpy_arg->size; offset += TRACE_BLOCK) {
+    size_t n = mt_memcpy_arg->size - offset < TRACE_BLOCK ? mt_memcpy_arg->size - offset : TRACE_BLOCK;
+    single_thread_memcpy(dst + offset, src + offset, n);
+    trace_point("block");
+  }
+#else
   // call the single thread function to copy the part of this thread
   single_thread_memcpy(dst, src, mt_memcpy_arg->size);
+#endif
   return NULL;
 }
 
@@ -129,6 +182,164 @@ void multi_thread_memcpy_with_affinity(void *dst, const void *src, size_t size,
   multi_thread_memcpy_with_attr(dst, src, size, k, &pthread_attr);
 }
 
+/*!
+ * \brief pin the thread of `rank` to the rank-th (round robin) CPU that
+ * the main thread may run on. The first-touch workers and the copy
+ * workers of the same rank thus share a CPU and a NUMA node.
+ *
+ * \param attr, the thread attribute to set the affinity on
+ * \param rank, the rank of the thread
+ */
+void set_rank_affinity(pthread_attr_t *attr, int rank) {
+  cpu_set_t allowed, cpu_set;
+  int err = pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &allowed);
+  assert(!err);
+
+  int target = rank % CPU_COUNT(&allowed);
+  CPU_ZERO(&cpu_set);
+  for (int cpu_id = 0, i = 0; cpu_id < CPU_SETSIZE; cpu_id++) {
+    if (CPU_ISSET(cpu_id, &allowed) && i++ == target) {
+      CPU_SET(cpu_id, &cpu_set);
+      break;
+    }
+  }
+
+  err = pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &cpu_set);
+  assert(!err);
+}
+
+/*!
+ * \brief run `routine` on k pinned threads, with the same partition of
+ * `size` bytes as multi_thread_memcpy. The residual bytes are left to
+ * the caller.
+ */
+void multi_thread_pinned(void *(*routine)(void *), void *dst, const void *src, size_t size, int k) {
+  MtMemcpyArg base_arg = { .src = src, .dst = dst, .size = size / k };
+
+  MtMemcpyArg* args = (MtMemcpyArg*) malloc(k * sizeof(MtMemcpyArg));
+  pthread_t* thread_handlers = (pthread_t*) malloc(k * sizeof(pthread_t));
+
+  for (int i = 0; i < k; i++) {
+    args[i] = base_arg;
+    args[i].rank = i;
+
+    pthread_attr_t pthread_attr;
+    int err = pthread_attr_init(&pthread_attr);
+    assert(!err);
+    set_rank_affinity(&pthread_attr, i);
+
+    err = pthread_create(thread_handlers + i, &pthread_attr, routine, args + i);
+    assert(!err);
+    pthread_attr_destroy(&pthread_attr);
+  }
+
+  for (int i = 0; i < k; i++) {
+    int err = pthread_join(thread_handlers[i], NULL);
+    assert(!err);
+  }
+
+  free(args);
+  free(thread_handlers);
+}
+
+/*!
+ * \brief subroutine function: fill the part of `src` and fault in the
+ * part of `dst` that this thread will copy later
+ */
+void *mt_first_touch(void *arg) {
+  MtMemcpyArg* mt_memcpy_arg = (MtMemcpyArg*) arg;
+  size_t page_size = getpagesize();
+
+  char* src = (char*) mt_memcpy_arg->src + mt_memcpy_arg->size * mt_memcpy_arg->rank;
+  char* dst = (char*) mt_memcpy_arg->dst + mt_memcpy_arg->size * mt_memcpy_arg->rank;
+
+  memset(src, 0x5a, mt_memcpy_arg->size);
+  for (size_t offset = 0; offset < mt_memcpy_arg->size; offset += page_size)
+    dst[offset] = 0;
+  return NULL;
+}
+
+/*!
+ * \brief place the pages of freshly allocated `dst` and `src` on the
+ * nodes of the pinned workers that will copy them, since Linux puts a
+ * page on the node of the thread that first touches it
+ *
+ * \param dst, destination pointer
+ * \param src, source pointer
+ * \param size, size of the buffers
+ * \param k, # of threads, must match the later copy
+ */
+void parallel_first_touch(void *dst, void *src, size_t size, int k) {
+  multi_thread_pinned(mt_first_touch, dst, src, size, k);
+
+  // the residual bytes are copied by the main thread, so it touches them.
+  if (size % k) {
+    memset(src + size / k * k, 0x5a, size % k);
+    memset(dst + size / k * k, 0, size % k);
+  }
+}
+
+/*!
+ * \brief multithreading memcpy with each rank pinned to the CPU that
+ * faulted in its part in parallel_first_touch
+ */
+void multi_thread_memcpy_first_touch(void *dst, const void *src, size_t size, int k) {
+  multi_thread_pinned(mt_memcpy, dst, src, size, k);
+
+  if (size % k)
+    single_thread_memcpy(dst + size / k * k, src + size / k * k, size % k);
+}
+
+/*!
+ * \brief move `size` bytes from `src` to `dst`. The whole pages in the
+ * middle are moved by remapping them into `dst` instead of copying; the
+ * unaligned head and tail bytes are copied. Afterwards `src` stays
+ * mapped but its moved pages read as zeros.
+ *
+ * Falls back to multi_thread_memcpy when the source must stay valid,
+ * when the move is small, when `src` and `dst` have different offsets
+ * within a page, or when the kernel refuses to remap (e.g. hugetlbfs
+ * pages not aligned to the huge page size).
+ *
+ * \param dst, destination pointer
+ * \param src, source pointer, dead after the move unless `keep_src`
+ * \param size, size of the data
+ * \param k, # of threads of the fallback copy
+ * \param keep_src, whether `src` must keep its contents
+ */
+void multi_thread_memcpy_move(void *dst, void *src, size_t size, int k, int keep_src) {
+  size_t page_size = getpagesize();
+  uintptr_t src_addr = (uintptr_t) src, dst_addr = (uintptr_t) dst;
+
+  if (keep_src || size < MOVE_MIN_BYTES || (src_addr - dst_addr) % page_size != 0) {
+    multi_thread_memcpy(dst, src, size, k);
+    return;
+  }
+
+  size_t head = (page_size - src_addr % page_size) % page_size;
+  size_t body = (size - head) / page_size * page_size;
+  size_t tail = size - head - body;
+
+  // MREMAP_DONTUNMAP (Linux 5.7+) leaves `src` mapped and empty.
+  void *moved = mremap(src + head, body, body,
+                       MREMAP_MAYMOVE | MREMAP_FIXED | MREMAP_DONTUNMAP, dst + head);
+  if (moved == MAP_FAILED) {
+    // older kernels: move, then map fresh zero pages back at `src`
+    moved = mremap(src + head, body, body, MREMAP_MAYMOVE | MREMAP_FIXED, dst + head);
+    if (moved != MAP_FAILED) {
+      void *p = mmap(src + head, body, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+      assert(p != MAP_FAILED);
+    }
+  }
+  if (moved == MAP_FAILED)
+    multi_thread_memcpy(dst + head, src + head, body, k);
+
+  // the head and tail are shorter than a page, a single thread is enough
+  single_thread_memcpy(dst, src, head);
+  single_thread_memcpy(dst + head + body, src + head + body, tail);
+}
+
 /** You may would like to define a new struct for
  *  the bonus question here.
 **/
@@ -157,9 +368,13 @@ void *mt_page_memcpy(void *data) {
   assert(arg->world_size % 2 == 0); // otherwise a thread would copy pages on different nodes
 
   size_t offset = arg->rank * page_size;
+  size_t pages = 0;
+  trace_point("page copy");
   while (offset + page_size <= arg->size) {
     single_thread_memcpy(arg->dst + offset, arg->src + offset, page_size);
     offset += page_size * arg->world_size;
+    if (++pages % (TRACE_BLOCK / page_size) == 0)
+      trace_point("block");
   }
 
   return NULL;
@@ -222,6 +437,191 @@ cleanup:
   free(args);
   free(thread_handlers);
 }
+
+/*!
+ * \brief single-producer/single-consumer ring of chunks between the
+ * reader and the writer of a pair. `head` and `tail` are counters of
+ * chunks, on separate cache lines so the two sides do not false share.
+ */
+typedef struct {
+  _Atomic size_t head __attribute__((aligned(64))); // chunks drained by the writer
+  _Atomic size_t tail __attribute__((aligned(64))); // chunks filled by the reader
+  char* slots; // CROSS_SLOTS * CROSS_CHUNK bytes of staging on the source node
+} CrossRing;
+
+typedef struct {
+  const void* src; // the starting address of the part of this pair
+  void* dst; // the starting address of the target part of this pair
+  size_t size; // the size that this pair should copy
+  CrossRing* ring; // the ring shared by the pair
+  int rank; // the rank of the pair
+} MtCrossArg;
+
+/* spin on a ring counter; yield once in a while in case both ends share a CPU */
+static void cross_wait(int spins) {
+  if (spins % 1024 == 1023)
+    sched_yield();
+}
+
+/*!
+ * \brief subroutine function of the reader: runs on the source node and
+ * streams its part of `src` into the staging ring
+ */
+void *mt_cross_reader(void *data) {
+  MtCrossArg* arg = (MtCrossArg*) data;
+  CrossRing* ring = arg->ring;
+
+#if PRINT_AFFINITY
+  if (print_affinity) {
+    int cpu, node;
+    int err = syscall(SYS_getcpu, &cpu, &node);
+    assert(!err);
+    printf("reader %d runs on cpu %d, NUMA node %d\n", arg->rank, cpu, node);
+  }
+#endif
+
+  size_t i = 0;
+  for (size_t offset = 0; offset < arg->size; offset += CROSS_CHUNK, i++) {
+    size_t n = arg->size - offset < CROSS_CHUNK ? arg->size - offset : CROSS_CHUNK;
+
+    // wait for a free slot
+    for (int spins = 0; i - atomic_load_explicit(&ring->head, memory_order_acquire) >= CROSS_SLOTS; spins++)
+      cross_wait(spins);
+
+    single_thread_memcpy(ring->slots + (i % CROSS_SLOTS) * CROSS_CHUNK, arg->src + offset, n);
+    atomic_store_explicit(&ring->tail, i + 1, memory_order_release);
+    if (i % (TRACE_BLOCK / CROSS_CHUNK) == 0)
+      trace_point("read");
+  }
+  return NULL;
+}
+
+/*!
+ * \brief subroutine function of the writer: runs on the target node and
+ * drains the staging ring into its part of `dst`
+ */
+void *mt_cross_writer(void *data) {
+  MtCrossArg* arg = (MtCrossArg*) data;
+  CrossRing* ring = arg->ring;
+
+#if PRINT_AFFINITY
+  if (print_affinity) {
+    int cpu, node;
+    int err = syscall(SYS_getcpu, &cpu, &node);
+    assert(!err);
+    printf("writer %d runs on cpu %d, NUMA node %d\n", arg->rank, cpu, node);
+  }
+#endif
+
+  size_t i = 0;
+  for (size_t offset = 0; offset < arg->size; offset += CROSS_CHUNK, i++) {
+    size_t n = arg->size - offset < CROSS_CHUNK ? arg->size - offset : CROSS_CHUNK;
+
+    // wait for a filled slot
+    for (int spins = 0; atomic_load_explicit(&ring->tail, memory_order_acquire) <= i; spins++)
+      cross_wait(spins);
+
+    single_thread_memcpy(arg->dst + offset, ring->slots + (i % CROSS_SLOTS) * CROSS_CHUNK, n);
+    atomic_store_explicit(&ring->head, i + 1, memory_order_release);
+    if (i % (TRACE_BLOCK / CROSS_CHUNK) == 0)
+      trace_point("write");
+  }
+  return NULL;
+}
+
+/*!
+ * \brief pin the attribute to the `index`-th (round robin) CPU of `node`
+ */
+void set_node_affinity(pthread_attr_t *attr, int node, int index) {
+  struct bitmask* cpus = numa_allocate_cpumask();
+  int err = numa_node_to_cpus(node, cpus);
+  assert(!err);
+
+  int n = numa_bitmask_weight(cpus);
+  assert(n > 0);
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (int cpu_id = 0, i = 0; cpu_id < cpus->size; cpu_id++) {
+    if (numa_bitmask_isbitset(cpus, cpu_id) && i++ == index % n) {
+      CPU_SET(cpu_id, &cpu_set);
+      break;
+    }
+  }
+  numa_free_cpumask(cpus);
+
+  err = pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &cpu_set);
+  assert(!err);
+}
+
+/*!
+ * \brief (Bonus Question) copy between buffers on different NUMA nodes
+ * with k/2 reader/writer pairs. Readers are pinned to the node of `src`
+ * and writers to the node of `dst`; each pair hands its chunks over
+ * through a staging ring allocated on the source node. Whether this
+ * beats MEM_INTER is an open question: it has only been run on a
+ * single-node host, where both ends share the node. Run the sweep on a
+ * multi-node host to compare them.
+ *
+ * \param dst, destination pointer
+ * \param src, source pointer
+ * \param size, size of the data
+ * \param k, # of threads, must be even
+ */
+void multi_thread_memcpy_cross_node(void *dst, const void *src, size_t size, int k) {
+  assert(k % 2 == 0);
+  int pairs = k / 2;
+
+  // both buffers have been touched, so their pages are already placed
+  int src_node, dst_node;
+  int err = get_mempolicy(&src_node, NULL, 0, (void *) src, MPOL_F_NODE | MPOL_F_ADDR);
+  assert(!err);
+  err = get_mempolicy(&dst_node, NULL, 0, dst, MPOL_F_NODE | MPOL_F_ADDR);
+  assert(!err);
+
+  size_t staging_size = pairs * CROSS_SLOTS * CROSS_CHUNK;
+  char* staging = numa_alloc_onnode(staging_size, src_node);
+  CrossRing* rings = (CrossRing*) aligned_alloc(64, pairs * sizeof(CrossRing));
+  MtCrossArg* args = (MtCrossArg*) malloc(k * sizeof(MtCrossArg));
+  pthread_t* thread_handlers = (pthread_t*) malloc(k * sizeof(pthread_t));
+  assert(staging != NULL && rings != NULL);
+
+  size_t size_per_pair = size / pairs;
+  for (int p = 0; p < pairs; p++) {
+    atomic_init(&rings[p].head, 0);
+    atomic_init(&rings[p].tail, 0);
+    rings[p].slots = staging + p * CROSS_SLOTS * CROSS_CHUNK;
+
+    // the last pair also copies the residual bytes
+    MtCrossArg arg = {
+      .src = src + size_per_pair * p, .dst = dst + size_per_pair * p,
+      .size = p == pairs - 1 ? size - size_per_pair * p : size_per_pair,
+      .ring = rings + p, .rank = p,
+    };
+    args[2 * p] = args[2 * p + 1] = arg;
+
+    for (int side = 0; side < 2; side++) {
+      pthread_attr_t pthread_attr;
+      err = pthread_attr_init(&pthread_attr);
+      assert(!err);
+      set_node_affinity(&pthread_attr, side == 0 ? src_node : dst_node, p);
+
+      err = pthread_create(thread_handlers + 2 * p + side, &pthread_attr,
+                           side == 0 ? mt_cross_reader : mt_cross_writer, args + 2 * p + side);
+      assert(!err);
+      pthread_attr_destroy(&pthread_attr);
+    }
+  }
+
+  for (int i = 0; i < k; i++) {
+    err = pthread_join(thread_handlers[i], NULL);
+    assert(!err);
+  }
+
+  numa_free(staging, staging_size);
+  free(rings);
+  free(args);
+  free(thread_handlers);
+}
 #endif
 
 /* benchmark: single-threaded version */
@@ -237,57 +637,343 @@ void single_thread_memcpy(void *dst, const void *src, size_t size) {
   }
 }
 
-int execute(const char *command, int len, int k)
-{
-  /* allocate memory */
-  float *dst = (float *) malloc( len * sizeof(float) );
-  float *src = (float *) malloc( len * sizeof(float) );
-  assert(dst != NULL);
-  assert(src != NULL);
+/*------------------------------ page options ------------------------------*/
 
-  /* warmup */
-#if WARMUP
-  memcpy(dst, src, len * sizeof(float));
+int valid_page_option(const char *option) {
+  return strcmp(option, PAGE_4K)==0 || strcmp(option, PAGE_THP)==0 ||
+         strcmp(option, PAGE_2M)==0 || strcmp(option, PAGE_1G)==0;
+}
+
+/*!
+ * \brief the length of the mapping backing a `size`-byte buffer, rounded
+ * up to the huge page size so a hugetlbfs mapping and its fallback can be
+ * unmapped the same way
+ */
+size_t mapping_length(size_t size) {
+  size_t huge = strcmp(page_option, PAGE_1G)==0 ? (1UL << 30) : (2UL << 20);
+  return (size + huge - 1) / huge * huge;
+}
+
+/*!
+ * \brief map `size` bytes with the page option, falling back to
+ * transparent huge pages and then to regular pages if hugetlbfs pages
+ * are not available
+ */
+void *alloc_huge(size_t size) {
+  size_t len = mapping_length(size);
+  void *p = MAP_FAILED;
+
+  if ( strcmp(page_option, PAGE_2M)==0 )
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+  else if ( strcmp(page_option, PAGE_1G)==0 )
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (30 << MAP_HUGE_SHIFT), -1, 0);
+
+  if (p == MAP_FAILED) {
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+      return NULL;
+    madvise(p, len, MADV_HUGEPAGE); // best effort, THP may be disabled
+  }
+  return p;
+}
+
+/*!
+ * \brief the node of the source (`is_dst` = 0) or target buffer of
+ * MEM_CROSS: the first and the last node, so they differ on multi-node hosts
+ */
+int cross_node(int is_dst) {
+  return is_dst ? numa_max_node() : 0;
+}
+
+/*!
+ * \brief allocate a buffer for the strategy with the page option
+ *
+ * \param command, the strategy, which decides the NUMA memory policy
+ * \param size, the size of the buffer in bytes
+ * \param is_dst, whether this is the target buffer
+ */
+void *alloc_buffer(const char *command, size_t size, int is_dst) {
+  if ( strcmp(page_option, PAGE_4K)==0 ) {
+    // a move remaps whole pages, so it needs page-aligned buffers
+    if ( strcmp(command, MOVE_REMAP)==0 ) {
+      void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      return p == MAP_FAILED ? NULL : p;
+    }
+#ifdef BUILD_BONUS
+    if ( strcmp(command, MEM_LOCAL)==0 )
+      return numa_alloc_local(size);
+    if ( strcmp(command, MEM_INTER)==0 )
+      return numa_alloc_interleaved(size);
+    if ( strcmp(command, MEM_CROSS)==0 )
+      return numa_alloc_onnode(size, cross_node(is_dst));
 #endif
+    return malloc(size);
+  }
 
-  /* timing the memcpy */
+  void *p = alloc_huge(size);
+#ifdef BUILD_BONUS
+  // apply the same policies as numa_alloc_* before any page is touched
+  if (p != NULL && strcmp(command, MEM_LOCAL)==0)
+    numa_setlocal_memory(p, mapping_length(size));
+  if (p != NULL && strcmp(command, MEM_INTER)==0)
+    numa_interleave_memory(p, mapping_length(size), numa_all_nodes_ptr);
+  if (p != NULL && strcmp(command, MEM_CROSS)==0)
+    numa_tonode_memory(p, mapping_length(size), cross_node(is_dst));
+#endif
+  return p;
+}
+
+void free_buffer(const char *command, void *p, size_t size) {
+  if ( strcmp(page_option, PAGE_4K)!=0 ) {
+    munmap(p, mapping_length(size));
+    return;
+  }
+  if ( strcmp(command, MOVE_REMAP)==0 ) {
+    munmap(p, size);
+    return;
+  }
+#ifdef BUILD_BONUS
+  if ( strcmp(command, MEM_LOCAL)==0 || strcmp(command, MEM_INTER)==0 ||
+       strcmp(command, MEM_CROSS)==0 ) {
+    numa_free(p, size);
+    return;
+  }
+#endif
+  free(p);
+}
+
+/*!
+ * \brief the page size actually backing `addr`, read from the
+ * KernelPageSize and AnonHugePages fields of /proc/self/smaps. Only
+ * meaningful once the pages have been touched.
+ *
+ * \return size_t, the page size in bytes, 0 if unknown
+ */
+size_t backed_page_size(const void *addr) {
+  FILE *fp = fopen("/proc/self/smaps", "r");
+  if (fp == NULL)
+    return 0;
+
+  char line[256];
+  int in_vma = 0;
+  size_t kernel_kb = 0, anon_huge_kb = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    unsigned long start, end;
+    if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+      if (in_vma)
+        break; // passed the mapping of `addr`
+      in_vma = (unsigned long)addr >= start && (unsigned long)addr < end;
+    }
+    else if (in_vma) {
+      sscanf(line, "KernelPageSize: %lu kB", &kernel_kb);
+      sscanf(line, "AnonHugePages: %lu kB", &anon_huge_kb);
+    }
+  }
+  fclose(fp);
+
+  if (anon_huge_kb > 0)
+    return 2UL << 20; // the PMD size used by THP on x86-64 and arm64 with 4 KB base pages
+  return kernel_kb * 1024;
+}
+
+const char *format_page_size(size_t page_size) {
+  static char buf[32];
+  if (page_size == 0)
+    return "unknown";
+  if (page_size >= (1UL << 30))
+    snprintf(buf, sizeof(buf), "%lu GB", page_size >> 30);
+  else if (page_size >= (1UL << 20))
+    snprintf(buf, sizeof(buf), "%lu MB", page_size >> 20);
+  else
+    snprintf(buf, sizeof(buf), "%lu KB", page_size >> 10);
+  return buf;
+}
+
+/*!
+ * \brief the pages backing both buffers, e.g. "2 MB", or "src 2 MB / dst
+ * 4 KB" when one of them fell back to smaller pages
+ */
+const char *format_buffer_pages(const void *src, const void *dst) {
+  static char buf[80];
+  size_t src_page = backed_page_size(src), dst_page = backed_page_size(dst);
+  char src_str[32];
+  snprintf(src_str, sizeof(src_str), "%s", format_page_size(src_page));
+  if (src_page == dst_page)
+    snprintf(buf, sizeof(buf), "%s", src_str);
+  else
+    snprintf(buf, sizeof(buf), "src %s / dst %s", src_str, format_page_size(dst_page));
+  return buf;
+}
+
+/* the smaller of the page sizes backing `src` and `dst`, 0 if either is unknown */
+size_t smaller_page_size(const void *src, const void *dst) {
+  size_t src_page = backed_page_size(src), dst_page = backed_page_size(dst);
+  return src_page < dst_page ? src_page : dst_page;
+}
+
+/*!
+ * \brief copy `size` bytes from `src` to `dst` with the given strategy
+ * and time it
+ *
+ * \param command, one of the strategy names defined above
+ * \param k, # of threads
+ * \return float, the elapsed time in microseconds, or a negative value
+ * if the strategy is unknown
+ */
+float timed_copy(const char *command, void *dst, const void *src, size_t size, int k)
+{
   struct timespec start, end;
   clock_gettime(CLOCK_MONOTONIC_RAW, &start);
   if ( strcmp(command, C_MEMCPY)==0 )
   {
-    memcpy(dst, src, len*sizeof(float));
+    memcpy(dst, src, size);
   }
   else if ( strcmp(command, SINGLE_THREAD)==0 )
   {
-    single_thread_memcpy(dst, src, len*sizeof(float));
+    single_thread_memcpy(dst, src, size);
   }
   else if ( strcmp(command, MULTI_THREAD)==0 )
   {
-    multi_thread_memcpy(dst, src, len*sizeof(float), k);
+    multi_thread_memcpy(dst, src, size, k);
   }
   else if ( strcmp(command, MULTI_AFFINITY)==0 )
   {
-    multi_thread_memcpy_with_affinity(dst, src, len*sizeof(float), k);
+    multi_thread_memcpy_with_affinity(dst, src, size, k);
+  }
+  else if ( strcmp(command, MULTI_FIRST_TOUCH)==0 )
+  {
+    multi_thread_memcpy_first_touch(dst, src, size, k);
+  }
+  else if ( strcmp(command, MOVE_REMAP)==0 )
+  {
+    // the source is dead after the move
+    multi_thread_memcpy_move(dst, (void *) src, size, k, 0);
+  }
+#ifdef BUILD_BONUS
+  else if ( strcmp(command, MEM_LOCAL)==0 || strcmp(command, MEM_INTER)==0 )
+  {
+    multi_thread_memcpy_with_interleaved_affinity(dst, src, size, k);
+  }
+  else if ( strcmp(command, MEM_CROSS)==0 )
+  {
+    multi_thread_memcpy_cross_node(dst, src, size, k);
   }
+#endif
   else
+  {
+    return -1;
+  }
+  clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+
+  return (end.tv_sec - start.tv_sec) * 1.0e6 +
+           (end.tv_nsec - start.tv_nsec) * 1.0e-3;
+}
+
+/*!
+ * \brief fault in freshly allocated buffers before timing: in parallel
+ * from the copy workers for MULTI_FIRST_TOUCH, from the main thread
+ * (fill `src`, then the warmup copy) otherwise. MOVE_REMAP gets an
+ * empty `dst` instead, so check_copy can tell whether the data arrived.
+ */
+void populate(const char *command, void *dst, void *src, size_t size, int k)
+{
+  if ( strcmp(command, MULTI_FIRST_TOUCH)==0 )
+  {
+    parallel_first_touch(dst, src, size, k);
+    return;
+  }
+
+  memset(src, MOVE_PATTERN, size);
+  if ( strcmp(command, MOVE_REMAP)==0 )
+  {
+    // a move targets fresh memory: drop the whole pages of `dst` and zero the rest
+    size_t page_size = getpagesize();
+    size_t head = (page_size - (uintptr_t) dst % page_size) % page_size;
+    size_t body = size > head ? (size - head) / page_size * page_size : 0;
+    head = head < size ? head : size;
+    memset(dst, 0, head);
+    if (body)
+      madvise(dst + head, body, MADV_DONTNEED);
+    memset(dst + head + body, 0, size - head - body);
+    return;
+  }
+#if WARMUP
+  memcpy(dst, src, size);
+#endif
+}
+
+/*!
+ * \brief check the result of a copy. `src` is dead after MOVE_REMAP, so
+ * `dst` is compared with the pattern populate() wrote instead.
+ */
+int check_copy(const char *command, const void *dst, const void *src, size_t size)
+{
+  if ( strcmp(command, MOVE_REMAP)==0 )
+  {
+    const unsigned char *p = dst;
+    for (size_t i = 0; i < size; i++)
+      if (p[i] != MOVE_PATTERN)
+        return 0;
+    return 1;
+  }
+  return memcmp(src, dst, size) == 0;
+}
+
+/* minor page faults of the process so far */
+long minor_faults(void)
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_minflt;
+}
+
+int execute(const char *command, int len, int k)
+{
+  /* allocate memory */
+  float *dst = (float *) alloc_buffer( command, len * sizeof(float), 1 );
+  float *src = (float *) alloc_buffer( command, len * sizeof(float), 0 );
+  assert(dst != NULL);
+  assert(src != NULL);
+
+  /* fault in the pages (and warmup) */
+  struct timespec start, end;
+  long faults_start = minor_faults();
+  clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+  populate(command, dst, src, len * sizeof(float), k);
+  clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+  long faults_populate = minor_faults() - faults_start;
+  float populate_us = (end.tv_sec - start.tv_sec) * 1.0e6 +
+                        (end.tv_nsec - start.tv_nsec) * 1.0e-3;
+
+  /* timing the memcpy */
+  faults_start = minor_faults();
+  float delta_us = timed_copy(command, dst, src, len*sizeof(float), k);
+  long faults_copy = minor_faults() - faults_start;
+  if (delta_us < 0)
   {
     fprintf(stderr, "execution failure.\n");
     goto out;
   }
-  clock_gettime(CLOCK_MONOTONIC_RAW, &end);
 
   /* check correctness (with "warmup" disabled) */
-  assert( memcmp(src, dst, len*sizeof(float)) == 0 );
+  assert( check_copy(command, dst, src, len*sizeof(float)) );
 
-  float delta_us = (end.tv_sec - start.tv_sec) * 1.0e6 +
-                     (end.tv_nsec - start.tv_nsec) * 1.0e-3;
-  printf("[%s]\tThe throughput is %.2f Gbps.\n",
-          command, len*sizeof(float)*8 / (delta_us*1000.0) );
+  printf("[%s]\tThe throughput is %.2f Gbps (%s pages).\n",
+          command, len*sizeof(float)*8 / (delta_us*1000.0),
+          format_buffer_pages(src, dst) );
+#if PRINT_FAULT_SPLIT
+  printf("[%s]\tpage faults: %.2f ms (%ld minor faults), copy: %.2f ms (%ld minor faults)\n",
+          command, populate_us / 1000.0, faults_populate, delta_us / 1000.0, faults_copy);
+#else
+  (void) populate_us; (void) faults_populate; (void) faults_copy;
+#endif
 
 out: 
   /* free the memory */
-  free(dst);
-  free(src);
+  free_buffer(command, dst, len * sizeof(float));
+  free_buffer(command, src, len * sizeof(float));
 
   return 0;
 }
@@ -297,17 +983,13 @@ int execute_numa(const char *command, int len, int k)
 {
   /* allocate memory */
   float *dst, *src;
-  if ( strcmp(command, MEM_LOCAL)==0 )
-  {
-    /* allocate memory (`*src`, `*dst`) locally on the current node */
-    src = numa_alloc_local(len * sizeof(float));
-    dst = numa_alloc_local(len * sizeof(float));
-  }
-  else if ( strcmp(command, MEM_INTER)==0 )
+  if ( strcmp(command, MEM_LOCAL)==0 || strcmp(command, MEM_INTER)==0 ||
+       strcmp(command, MEM_CROSS)==0 )
   {
-    /* allocate memory (`*src`, `*dst`) interleaved on each node */
-    src = numa_alloc_interleaved(len * sizeof(float));
-    dst = numa_alloc_interleaved(len * sizeof(float));
+    /* allocate memory (`*src`, `*dst`) locally on the current node,
+     * interleaved on each node, or on two different nodes, see alloc_buffer */
+    src = alloc_buffer(command, len * sizeof(float), 0);
+    dst = alloc_buffer(command, len * sizeof(float), 1);
   }
   else
   {
@@ -318,6 +1000,7 @@ int execute_numa(const char *command, int len, int k)
   assert(src != NULL);
 
 #if PRINT_AFFINITY
+  if (print_affinity) {
     int node;
     size_t page_size = getpagesize();
     int err = get_mempolicy(&node, NULL, 0, src, MPOL_F_NODE | MPOL_F_ADDR);
@@ -332,44 +1015,241 @@ int execute_numa(const char *command, int len, int k)
     err = get_mempolicy(&node, NULL, 0, dst + page_size / sizeof(float), MPOL_F_NODE | MPOL_F_ADDR);
     assert(!err);
     printf("the second page of dst is on node %d\n", node);
+  }
 #endif
 
-  /* warmup */
-#if WARMUP
-  memcpy(dst, src, len * sizeof(float));
-#endif
+  /* fault in the pages (and warmup) */
+  populate(command, dst, src, len * sizeof(float), k);
 
   /* timing the memcpy */
-  struct timespec start, end;
-  clock_gettime(CLOCK_MONOTONIC_RAW, &start);
-  multi_thread_memcpy_with_interleaved_affinity(dst, src, len*sizeof(float), k);
-  clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+  float delta_us = timed_copy(command, dst, src, len*sizeof(float), k);
 
   /* check correctness (with "warmup" disabled) */
   assert( memcmp(src, dst, len*sizeof(float)) == 0 );
 
-  float delta_us = (end.tv_sec - start.tv_sec) * 1.0e6 +
-                     (end.tv_nsec - start.tv_nsec) * 1.0e-3;
-  printf("[%s]\tThe throughput is %.2f Gbps.\n",
-          command, len*sizeof(float)*8 / (delta_us*1000.0) );
+  printf("[%s]\tThe throughput is %.2f Gbps (%s pages).\n",
+          command, len*sizeof(float)*8 / (delta_us*1000.0),
+          format_buffer_pages(src, dst) );
   
   /* free `*dst` and `*src` */
-  numa_free(src, len * sizeof(float));
-  numa_free(dst, len * sizeof(float));
+  free_buffer(command, src, len * sizeof(float));
+  free_buffer(command, dst, len * sizeof(float));
   return 0;
 }
 #endif
 
+/*------------------------------ sweep mode ------------------------------*/
+
+typedef struct {
+  const char* key; // short name used in the machine-readable output
+  const char* command; // the strategy name understood by `timed_copy`
+} Strategy;
+
+static const Strategy strategies[] = {
+  { "C_MEMCPY", C_MEMCPY },
+  { "SINGLE_THREAD", SINGLE_THREAD },
+  { "MULTI_THREAD", MULTI_THREAD },
+  { "MULTI_AFFINITY", MULTI_AFFINITY },
+  { "MULTI_FIRST_TOUCH", MULTI_FIRST_TOUCH },
+  { "MOVE_REMAP", MOVE_REMAP },
+  { "MEM_LOCAL", MEM_LOCAL },
+  { "MEM_INTER", MEM_INTER },
+  { "MEM_CROSS", MEM_CROSS },
+};
+
+typedef struct {
+  int repeats; // the number of timed copies
+  double mean; // mean throughput (Gbps)
+  double ci95; // half width of the 95% confidence interval (Gbps)
+  double min, max; // extreme throughputs (Gbps)
+} SweepResult;
+
+/* two-sided 95% quantiles of Student's t distribution, indexed by degrees of freedom */
+static const double t95[] = { 0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365,
+  2.306, 2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101,
+  2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+
+static double t95_quantile(int df) {
+  return df < (int)(sizeof(t95) / sizeof(t95[0])) ? t95[df] : 1.960;
+}
+
+/*!
+ * \brief whether the strategy can run with `k` threads on this host
+ */
+int sweep_feasible(const char *command, int k) {
+  int nprocs = get_nprocs();
+  if ( strcmp(command, C_MEMCPY)==0 || strcmp(command, SINGLE_THREAD)==0 )
+    return k == 1; // the thread count does not apply
+  if ( strcmp(command, MULTI_THREAD)==0 || strcmp(command, MULTI_FIRST_TOUCH)==0 ||
+       strcmp(command, MOVE_REMAP)==0 )
+    return k <= nprocs;
+  if ( strcmp(command, MULTI_AFFINITY)==0 )
+    return k <= nprocs / 2; // see the assertion in multi_thread_memcpy_with_affinity
+#ifdef BUILD_BONUS
+  if ( strcmp(command, MEM_LOCAL)==0 || strcmp(command, MEM_INTER)==0 )
+    return numa_available() != -1 && k % 2 == 0 && k < nprocs;
+  if ( strcmp(command, MEM_CROSS)==0 )
+    return numa_available() != -1 && k % 2 == 0 && k <= nprocs;
+#endif
+  return 0;
+}
+
+/*!
+ * \brief repeat one (strategy, size, threads) point until the 95%
+ * confidence interval of its throughput converges
+ */
+SweepResult sweep_point(const char *command, void *dst, void *src, size_t size, int k) {
+  SweepResult r = { .min = INFINITY, .max = 0 };
+  double sum = 0, sum_sq = 0;
+
+  // the affinity variants pin the main thread, restore it after every copy
+  cpu_set_t main_cpu_set;
+  pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &main_cpu_set);
+
+  while (r.repeats < SWEEP_MAX_REPEAT) {
+    // a move consumes `src`, refill both buffers outside the timing
+    if (r.repeats > 0 && strcmp(command, MOVE_REMAP)==0)
+      populate(command, dst, src, size, k);
+
+    float delta_us = timed_copy(command, dst, src, size, k);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &main_cpu_set);
+    assert(delta_us >= 0);
+
+    double gbps = size * 8 / (delta_us * 1000.0);
+    sum += gbps;
+    sum_sq += gbps * gbps;
+    r.min = gbps < r.min ? gbps : r.min;
+    r.max = gbps > r.max ? gbps : r.max;
+    r.repeats++;
+
+    r.mean = sum / r.repeats;
+    if (r.repeats >= SWEEP_MIN_REPEAT) {
+      double var = (sum_sq - sum * sum / r.repeats) / (r.repeats - 1);
+      r.ci95 = t95_quantile(r.repeats - 1) * sqrt(var > 0 ? var : 0) / sqrt(r.repeats);
+      if (r.ci95 <= SWEEP_REL_CI * r.mean)
+        break;
+    }
+  }
+
+  assert( check_copy(command, dst, src, size) );
+  return r;
+}
+
+/*!
+ * \brief copy `in` into `out` as the body of a JSON string: `"` and `\`
+ * are escaped, control characters written as \u00XX; truncated to fit
+ * `size` bytes
+ */
+const char *json_escape(const char *in, char *out, size_t size) {
+  size_t n = 0;
+  for (; *in && n + 7 < size; in++) {
+    unsigned char c = (unsigned char) *in;
+    if (c == '"' || c == '\\') {
+      out[n++] = '\\';
+      out[n++] = c;
+    }
+    else if (c < 0x20)
+      n += snprintf(out + n, size - n, "\\u%04x", c);
+    else
+      out[n++] = c;
+  }
+  out[n] = '\0';
+  return out;
+}
+
+/*!
+ * \brief run every strategy over sizes from SWEEP_MIN_BYTES to
+ * `max_size` (x4 per step) and thread counts from 1 to all cores (x2
+ * per step), and print one record per point as CSV or JSON
+ *
+ * \param json, print JSON instead of CSV
+ * \param max_size, the largest buffer size in bytes
+ */
+void sweep(int json, size_t max_size) {
+  int nprocs = get_nprocs();
+  char host[256] = "unknown";
+  gethostname(host, sizeof(host) - 1);
+
+  print_affinity = 0;
+
+  if (json) {
+    char host_json[6 * sizeof(host)], pages_json[64];
+    printf("{\"host\": \"%s\", \"nprocs\": %d, \"numa_nodes\": %d, \"pages\": \"%s\", \"unit\": \"Gbps\", \"results\": [",
+           json_escape(host, host_json, sizeof(host_json)), nprocs,
+           numa_available() != -1 ? numa_num_configured_nodes() : 1,
+           json_escape(page_option, pages_json, sizeof(pages_json)));
+  }
+  else
+    printf("host,strategy,bytes,threads,repeats,mean_gbps,ci95_gbps,min_gbps,max_gbps,page_bytes\n");
+
+  int first = 1;
+  for (size_t size = SWEEP_MIN_BYTES; size <= max_size; size *= 4) {
+    for (int s = 0; s < sizeof(strategies) / sizeof(strategies[0]); s++) {
+      const Strategy* strategy = strategies + s;
+
+      for (int k = 1; k <= nprocs; k = k < nprocs && k * 2 > nprocs ? nprocs : k * 2) {
+        if (!sweep_feasible(strategy->command, k))
+          continue;
+
+        // fresh buffers for every point, since the page placement may depend on k
+        void *src = alloc_buffer(strategy->command, size, 0);
+        void *dst = alloc_buffer(strategy->command, size, 1);
+        assert(dst != NULL);
+        assert(src != NULL);
+        populate(strategy->command, dst, src, size, k);
+
+        SweepResult r = sweep_point(strategy->command, dst, src, size, k);
+        size_t page_size = smaller_page_size(src, dst); // page_bytes: the worse of both buffers
+        if (json)  // the strategy keys are identifiers, nothing to escape
+          printf("%s\n  {\"strategy\": \"%s\", \"bytes\": %lu, \"threads\": %d, \"repeats\": %d, "
+                 "\"mean_gbps\": %.3f, \"ci95_gbps\": %.3f, \"min_gbps\": %.3f, \"max_gbps\": %.3f, \"page_bytes\": %lu}",
+                 first ? "" : ",", strategy->key, size, k, r.repeats, r.mean, r.ci95, r.min, r.max, page_size);
+        else
+          printf("%s,%s,%lu,%d,%d,%.3f,%.3f,%.3f,%.3f,%lu\n",
+                 host, strategy->key, size, k, r.repeats, r.mean, r.ci95, r.min, r.max, page_size);
+        fflush(stdout);
+        first = 0;
+
+        free_buffer(strategy->command, src, size);
+        free_buffer(strategy->command, dst, size);
+
+        if (k == nprocs)
+          break;
+      }
+    }
+  }
+
+  if (json)
+    printf("\n]}\n");
+}
+
 int main(int argc, char *argv[]) {
-  if (argc != 3) {
+  if (argc >= 2 && strcmp(argv[1], "--sweep")==0) {
+    const char* format = argc >= 3 ? argv[2] : "csv";
+    size_t max_size = argc >= 4 ? strtoull(argv[3], NULL, 10) : SWEEP_MAX_BYTES;
+    page_option = argc >= 5 ? argv[4] : PAGE_4K;
+    if ( (strcmp(format, "csv") && strcmp(format, "json")) || max_size < SWEEP_MIN_BYTES ||
+         !valid_page_option(page_option) ) {
+      fprintf(stderr, "Usage: %s --sweep [csv|json] [max bytes] [4k|thp|2m|1g]\n", argv[0]);
+      exit(1);
+    }
+    sweep(strcmp(format, "json")==0, max_size);
+    return 0;
+  }
+
+  if (argc != 3 && argc != 4) {
     fprintf(stderr,
             "Error: The program accepts exact 2 intergers.\n The first is the "
-            "vector size and the second is the number of threads.\n");
+            "vector size and the second is the number of threads.\n"
+            " An optional third argument selects the pages: 4k (default), thp, 2m or 1g.\n"
+            " Or run `%s --sweep [csv|json] [max bytes] [4k|thp|2m|1g]` for a bandwidth sweep.\n", argv[0]);
     exit(1);
   }
+  if (argc == 4)
+    page_option = argv[3];
   const int len = atoi(argv[1]);
   const int k = atoi(argv[2]);
-  if (len < 0 || k < 1) {
+  if (len < 0 || k < 1 || !valid_page_option(page_option)) {
     fprintf(stderr, "Error: invalid arguments.\n");
     exit(1);
   }
@@ -381,6 +1261,11 @@ int main(int argc, char *argv[]) {
   execute(SINGLE_THREAD, len, k);
   /* multi-threaded memcpy */
   execute(MULTI_THREAD, len, k);
+  /* multi-threaded memcpy with pages placed by the pinned workers
+   * (before MULTI_AFFINITY, which restricts the main thread to one node) */
+  execute(MULTI_FIRST_TOUCH, len, k);
+  /* moving the pages of a dead source instead of copying them */
+  execute(MOVE_REMAP, len, k);
   /* multi-threaded memcpy with affinity set */
   execute(MULTI_AFFINITY, len, k);
 
@@ -389,6 +1274,10 @@ int main(int argc, char *argv[]) {
   execute_numa(MEM_LOCAL, len, k);
   /* Bonus: multi-threaded memcpy with interleaved NUMA memory policy */
   execute_numa(MEM_INTER, len, k);
+  /* Bonus: src and dst on different nodes, copied by a reader/writer
+   * pipeline; not yet measured against the interleaved policy above on
+   * a multi-node host */
+  execute_numa(MEM_CROSS, len, k);
 #endif
 
   return 0;
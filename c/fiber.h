@@ -0,0 +1,372 @@
+/*
+ * An M:N fiber runtime: stackful coroutines multiplexed over a few worker
+ * pthreads. Every worker has its own run queue; `fiber_spawn` deals the
+ * fibers out round robin and a fiber stays on its worker for its whole
+ * life, so `__thread` variables keep working inside fibers. A switch is
+ * a hand-written save of the callee-saved registers and the stack
+ * pointer, no system call and no signal mask like swapcontext. Fibers
+ * `fiber_yield` to the next fiber of their worker and `fiber_join` each
+ * other; a blocked fiber costs its stack and nothing else.
+ *
+ * A fiber must not block its worker for long (a pthread mutex held
+ * across a `fiber_yield`, a blocking read), every other fiber of the
+ * worker would wait too.
+ */
+#ifndef FIBER_H
+#define FIBER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <assert.h>
+#include <sys/mman.h>
+
+#if !defined(__x86_64__)
+#error "fiber.h switches contexts with x86-64 assembly"
+#endif
+
+#ifndef CACHE_LINE
+#define CACHE_LINE 64
+#endif
+
+#define FIBER_STACK (64 * 1024)
+#define FIBER_GUARD 4096        // a PROT_NONE page below every stack
+#define FIBER_DONE ((fiber_t*)1) // `joiner` of a finished fiber
+
+typedef enum {
+    FIBER_RUNNABLE,
+    FIBER_BLOCKED,  // in `fiber_join`, back in a run queue when the joined fiber finishes
+    FIBER_FINISHED, // returned, its stack is released once the worker left it
+} fiber_state_t;
+
+struct _fiber_worker_t;
+
+typedef struct _fiber_t {
+    void* sp;                       // the saved stack pointer while switched out
+    void* (*fn)(void*);
+    void* arg;
+    void* result;
+    fiber_state_t state;
+    struct _fiber_t* next;          // run queue link
+    struct _fiber_t* joiner;        // the fiber waiting in `fiber_join`, FIBER_DONE once finished
+    struct _fiber_worker_t* worker;
+    char* stack;                    // the mapping, guard page included
+} fiber_t;
+
+typedef struct _fiber_worker_t {
+    void* sched_sp;                 // the scheduler loop, switched to when a fiber blocks or ends
+    fiber_t* current;
+    fiber_t* head;                  // the run queue, FIFO
+    fiber_t* tail;
+    pthread_mutex_t lock;           // the run queue
+    pthread_cond_t cond;            // the run queue is no longer empty
+    int stop;
+    int id;
+    long switches;
+    struct _fiber_runtime_t* rt;
+    pthread_t thread;
+} __attribute__((aligned(CACHE_LINE))) fiber_worker_t;
+
+typedef struct _fiber_runtime_t {
+    fiber_worker_t* workers;
+    int n_workers;
+    unsigned next_worker;           // round robin of `fiber_spawn`
+    pthread_mutex_t stack_lock;     // the stacks of finished fibers, reused by `fiber_spawn`
+    char** free_stacks;
+    int n_free;
+    int cap_free;
+} fiber_runtime_t;
+
+static __thread fiber_worker_t* fiber_self_worker = NULL;
+
+/*---------------------------- context switch ----------------------------*/
+
+/*!
+ * \brief save the callee-saved registers on the current stack, store the
+ * stack pointer in `*save_sp`, and resume the context saved at
+ * `next_sp`. The caller-saved registers are spilled by the compiler
+ * around the call. The SSE and x87 control words are not switched, the
+ * fibers share the defaults.
+ */
+__attribute__((naked, noinline)) static void fiber_switch(void** save_sp, void* next_sp) {
+    __asm__ volatile(
+        "pushq %rbp\n\t"
+        "pushq %rbx\n\t"
+        "pushq %r12\n\t"
+        "pushq %r13\n\t"
+        "pushq %r14\n\t"
+        "pushq %r15\n\t"
+        "movq %rsp, (%rdi)\n\t"
+        "movq %rsi, %rsp\n\t"
+        "popq %r15\n\t"
+        "popq %r14\n\t"
+        "popq %r13\n\t"
+        "popq %r12\n\t"
+        "popq %rbx\n\t"
+        "popq %rbp\n\t"
+        "ret\n\t");
+}
+
+/* the first return of a new fiber lands here: r12 is the fiber, r13 `fiber_main` */
+__attribute__((naked, noinline)) static void fiber_trampoline() {
+    __asm__ volatile(
+        "movq %r12, %rdi\n\t"
+        "callq *%r13\n\t"
+        "ud2\n\t");
+}
+
+__attribute__((noreturn)) static void fiber_main(fiber_t* f) {
+    f->result = f->fn(f->arg);
+    f->state = FIBER_FINISHED;
+    fiber_switch(&f->sp, fiber_self_worker->sched_sp);
+    __builtin_unreachable();
+}
+
+/*---------------------------- stacks ----------------------------*/
+
+/* a stack of a finished fiber, or a new mapping; NULL when out of memory or mappings */
+static inline char* fiber_stack_get(fiber_runtime_t* rt) {
+    char* stack = NULL;
+    pthread_mutex_lock(&rt->stack_lock);
+    if (rt->n_free > 0) {
+        stack = rt->free_stacks[--rt->n_free];
+    }
+    pthread_mutex_unlock(&rt->stack_lock);
+    if (stack) {
+        return stack;
+    }
+    void* m = mmap(NULL, FIBER_GUARD + FIBER_STACK, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (m == MAP_FAILED) {
+        return NULL;
+    }
+    if (mprotect(m, FIBER_GUARD, PROT_NONE) != 0) {
+        munmap(m, FIBER_GUARD + FIBER_STACK);
+        return NULL;
+    }
+    return (char*)m;
+}
+
+static inline void fiber_stack_put(fiber_runtime_t* rt, char* stack) {
+    pthread_mutex_lock(&rt->stack_lock);
+    if (rt->n_free == rt->cap_free) {
+        rt->cap_free = rt->cap_free ? rt->cap_free * 2 : 64;
+        rt->free_stacks = (char**)realloc(rt->free_stacks, rt->cap_free * sizeof(char*));
+        assert(rt->free_stacks);
+    }
+    rt->free_stacks[rt->n_free++] = stack;
+    pthread_mutex_unlock(&rt->stack_lock);
+}
+
+/*---------------------------- scheduling ----------------------------*/
+
+static inline void fiber_enqueue(fiber_worker_t* w, fiber_t* f) {
+    f->state = FIBER_RUNNABLE;
+    f->next = NULL;
+    pthread_mutex_lock(&w->lock);
+    if (w->tail) {
+        w->tail->next = f;
+    } else {
+        w->head = f;
+    }
+    w->tail = f;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/* the head of the run queue, NULL if empty; with `w->lock` held */
+static inline fiber_t* fiber_dequeue_locked(fiber_worker_t* w) {
+    fiber_t* f = w->head;
+    if (f) {
+        w->head = f->next;
+        if (!w->head) {
+            w->tail = NULL;
+        }
+    }
+    return f;
+}
+
+/*!
+ * \brief `f` returned and the worker is off its stack: recycle the stack,
+ * then tell the joiner. `f` may be freed by the joiner right after the
+ * exchange, so nothing touches it afterwards.
+ */
+static inline void fiber_complete(fiber_t* f) {
+    fiber_stack_put(f->worker->rt, f->stack);
+    f->stack = NULL;
+    fiber_t* joiner = __atomic_exchange_n(&f->joiner, FIBER_DONE, __ATOMIC_ACQ_REL);
+    if (joiner) {
+        fiber_enqueue(joiner->worker, joiner);
+    }
+}
+
+static void* fiber_worker_loop(void* arg) {
+    fiber_worker_t* w = (fiber_worker_t*)arg;
+    fiber_self_worker = w;
+    for (;;) {
+        pthread_mutex_lock(&w->lock);
+        fiber_t* f;
+        while (!(f = fiber_dequeue_locked(w)) && !w->stop) {
+            pthread_cond_wait(&w->cond, &w->lock);
+        }
+        pthread_mutex_unlock(&w->lock);
+        if (!f) {
+            break;
+        }
+        w->current = f;
+        ++w->switches;
+        fiber_switch(&w->sched_sp, f->sp);
+        // back from whichever fiber blocked or finished, fibers yield to each other directly
+        f = w->current;
+        w->current = NULL;
+        if (f->state == FIBER_FINISHED) {
+            fiber_complete(f);
+        }
+    }
+    return NULL;
+}
+
+static inline void fiber_runtime_init(fiber_runtime_t* rt, int n_workers) {
+    rt->workers = (fiber_worker_t*)aligned_alloc(CACHE_LINE, n_workers * sizeof(fiber_worker_t));
+    assert(rt->workers);
+    memset(rt->workers, 0, n_workers * sizeof(fiber_worker_t));
+    rt->n_workers = n_workers;
+    rt->next_worker = 0;
+    pthread_mutex_init(&rt->stack_lock, NULL);
+    rt->free_stacks = NULL;
+    rt->n_free = rt->cap_free = 0;
+    for (int i = 0; i < n_workers; ++i) {
+        fiber_worker_t* w = &rt->workers[i];
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->cond, NULL);
+        w->id = i;
+        w->rt = rt;
+        assert( pthread_create(&w->thread, NULL, fiber_worker_loop, w) == 0 );
+    }
+}
+
+/* stop the workers, once every fiber is joined */
+static inline void fiber_runtime_destroy(fiber_runtime_t* rt) {
+    for (int i = 0; i < rt->n_workers; ++i) {
+        fiber_worker_t* w = &rt->workers[i];
+        pthread_mutex_lock(&w->lock);
+        w->stop = 1;
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+    }
+    for (int i = 0; i < rt->n_workers; ++i) {
+        fiber_worker_t* w = &rt->workers[i];
+        assert( pthread_join(w->thread, NULL) == 0 );
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->cond);
+    }
+    for (int i = 0; i < rt->n_free; ++i) {
+        munmap(rt->free_stacks[i], FIBER_GUARD + FIBER_STACK);
+    }
+    free(rt->free_stacks);
+    pthread_mutex_destroy(&rt->stack_lock);
+    free(rt->workers);
+}
+
+/* the id of the worker running the caller, -1 outside the runtime */
+static inline int fiber_worker_id() {
+    return fiber_self_worker ? fiber_self_worker->id : -1;
+}
+
+/*!
+ * \brief start `fn(arg)` on a fiber of the next worker, round robin.
+ * Callable from fibers and from plain threads.
+ *
+ * \return the fiber, to be passed to `fiber_join` exactly once, or NULL
+ * if no stack can be mapped (vm.max_map_count: two mappings per live
+ * stack)
+ */
+static inline fiber_t* fiber_spawn(fiber_runtime_t* rt, void* (*fn)(void*), void* arg) {
+    fiber_t* f = (fiber_t*)calloc(1, sizeof(fiber_t));
+    assert(f);
+    f->stack = fiber_stack_get(rt);
+    if (!f->stack) {
+        free(f);
+        return NULL;
+    }
+    f->fn = fn;
+    f->arg = arg;
+
+    /* the frame `fiber_switch` pops: r15, r14, r13, r12, rbx, rbp and the
+     * return address, placed so the stack is 16-byte aligned at the call
+     * in `fiber_trampoline` */
+    void** sp = (void**)(f->stack + FIBER_GUARD + FIBER_STACK - 72);
+    memset(sp, 0, 72);
+    sp[2] = (void*)fiber_main;
+    sp[3] = f;
+    sp[6] = (void*)fiber_trampoline;
+    f->sp = sp;
+
+    unsigned i = __atomic_fetch_add(&rt->next_worker, 1, __ATOMIC_RELAXED) % rt->n_workers;
+    f->worker = &rt->workers[i];
+    fiber_enqueue(f->worker, f);
+    return f;
+}
+
+/*!
+ * \brief let the next runnable fiber of this worker run, switching to it
+ * directly. Returns at once if there is none; `sched_yield` outside the
+ * runtime.
+ */
+static inline void fiber_yield() {
+    fiber_worker_t* w = fiber_self_worker;
+    if (!w || !w->current) {
+        sched_yield();
+        return;
+    }
+    fiber_t* self = w->current;
+    pthread_mutex_lock(&w->lock);
+    fiber_t* next = fiber_dequeue_locked(w);
+    if (next) {
+        // only this worker dequeues, so `self` cannot resume before it is switched out
+        self->next = NULL;
+        if (w->tail) {
+            w->tail->next = self;
+        } else {
+            w->head = self;
+        }
+        w->tail = self;
+    }
+    pthread_mutex_unlock(&w->lock);
+    if (!next) {
+        return;
+    }
+    w->current = next;
+    ++w->switches;
+    fiber_switch(&self->sp, next->sp);
+}
+
+/*!
+ * \brief wait until `f` returned, free it and return its result. A fiber
+ * blocks and its worker runs the others; a plain thread (main) polls
+ * with `sched_yield`.
+ */
+static inline void* fiber_join(fiber_t* f) {
+    fiber_worker_t* w = fiber_self_worker;
+    fiber_t* self = w ? w->current : NULL;
+    if (self) {
+        fiber_t* expected = NULL;
+        self->state = FIBER_BLOCKED;
+        if (__atomic_compare_exchange_n(&f->joiner, &expected, self, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            // `fiber_complete` puts us back in the run queue, only after this switch saved `self`
+            fiber_switch(&self->sp, w->sched_sp);
+        }
+        self->state = FIBER_RUNNABLE;
+    } else {
+        while (__atomic_load_n(&f->joiner, __ATOMIC_ACQUIRE) != FIBER_DONE) {
+            sched_yield();
+        }
+    }
+    void* result = f->result;
+    free(f);
+    return result;
+}
+
+#endif /* FIBER_H */
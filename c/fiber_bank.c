@@ -0,0 +1,175 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <assert.h>
+#include <time.h>
+#include <sys/sysinfo.h>
+
+#include "fiber.h"
+#include "util.h"
+
+#define INIT_BALANCE 1000
+#define AMOUNT 100
+#define MAX_PRINT 16 // print the transfers, like bank.c, only up to this many
+
+typedef struct _account_t {
+    int balance;
+    pthread_mutex_t m;
+    int aid;
+} account_t;
+
+typedef struct _transfer_args_t {
+    account_t* from;
+    account_t* to;
+    int amount;
+} transfer_arg_t;
+
+/* a run of transfers, for the driver fiber */
+typedef struct _batch_t {
+    fiber_runtime_t* rt;
+    transfer_arg_t* args;
+    int n;
+} batch_t;
+
+static int verbose = 0;
+
+/* `transfer` of bank.c; the critical section never yields, so the
+ * pthread mutexes are fine on fibers too */
+void* transfer(void *arg) {
+    transfer_arg_t* tran = (transfer_arg_t*)(arg);
+
+    if (verbose) {
+        printf("%d -> %d transfer $%d\n", tran->from->aid, tran->to->aid, tran->amount);
+    }
+
+    if (tran->from->aid < tran->to->aid) {
+        pthread_mutex_lock(&tran->from->m);
+        pthread_mutex_lock(&tran->to->m);
+    } else {
+        pthread_mutex_lock(&tran->to->m);
+        pthread_mutex_lock(&tran->from->m);
+    }
+
+    tran->from->balance -= tran->amount;
+    tran->to->balance += tran->amount;
+
+    pthread_mutex_unlock(&tran->to->m);
+    pthread_mutex_unlock(&tran->from->m);
+    return NULL;
+}
+
+void create_account(account_t* acct, int balance) {
+    static int aid = 0;
+    acct->balance = balance;
+    acct->aid = ++aid;
+    pthread_mutex_init(&acct->m, NULL);
+}
+
+/*!
+ * \brief one fiber per transfer, spawned and joined from a fiber, so the
+ * joins block the driver instead of polling. When no stack can be
+ * mapped, join the fibers so far and go on.
+ */
+void* drive_fibers(void* arg) {
+    batch_t* b = (batch_t*)arg;
+    fiber_t** fibers = (fiber_t**)malloc(b->n * sizeof(fiber_t*));
+    assert(fibers);
+    int done = 0;
+    while (done < b->n) {
+        int spawned = done;
+        while (spawned < b->n && (fibers[spawned] = fiber_spawn(b->rt, transfer, &b->args[spawned]))) {
+            ++spawned;
+        }
+        assert(spawned > done);
+        for (; done < spawned; ++done) {
+            fiber_join(fibers[done]);
+        }
+    }
+    free(fibers);
+    return NULL;
+}
+
+/* one pthread per transfer like bank.c; when the system runs out of threads, join the ones so far and go on */
+void drive_threads(transfer_arg_t* args, int n) {
+    pthread_t* threads = (pthread_t*)malloc(n * sizeof(pthread_t));
+    assert(threads);
+    int done = 0;
+    while (done < n) {
+        int created = done;
+        while (created < n && pthread_create(&threads[created], NULL, transfer, &args[created]) == 0) {
+            ++created;
+        }
+        assert(created > done);
+        for (; done < created; ++done) {
+            assert( pthread_join(threads[done], NULL) == 0 );
+        }
+    }
+    free(threads);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 3) {
+        printf("Usage: %s [<transfers> [<workers>]]\n"
+               "Apply <transfers> transfers between two accounts, with one fiber per transfer on "
+               "<workers> pthreads (default: all cores), then with one pthread per transfer.\n", argv[0]);
+        exit(1);
+    }
+    const int n = argc >= 2 ? atoi(argv[1]) : 100000;
+    const int n_workers = argc == 3 ? atoi(argv[2]) : get_nprocs();
+    if (n < 1 || n_workers < 1) {
+        printf("Error: invalid arguments.\n");
+        exit(1);
+    }
+    verbose = n <= MAX_PRINT;
+
+    /* create two accounts */
+    account_t a1, a2;
+    create_account(&a1, INIT_BALANCE);
+    create_account(&a2, INIT_BALANCE);
+    printf("main begin: a1's balance=%d, a2's balance=%d\n", a1.balance, a2.balance);
+
+    /* the transfers alternate between both directions */
+    transfer_arg_t* args = (transfer_arg_t*)malloc(n * sizeof(transfer_arg_t));
+    assert(args);
+    for (int i = 0; i < n; ++i) {
+        args[i].from = i % 2 ? &a2 : &a1;
+        args[i].to = i % 2 ? &a1 : &a2;
+        args[i].amount = AMOUNT;
+    }
+    const int a1_expected = INIT_BALANCE - (n % 2) * AMOUNT; // after one run
+
+    /* fibers */
+    fiber_runtime_t rt;
+    fiber_runtime_init(&rt, n_workers);
+    batch_t batch = { &rt, args, n };
+    uint64_t start = now_ns();
+    fiber_t* driver = fiber_spawn(&rt, drive_fibers, &batch);
+    assert(driver);
+    fiber_join(driver);
+    uint64_t fiber_ns = now_ns() - start;
+    long switches = 0;
+    for (int i = 0; i < n_workers; ++i) {
+        switches += rt.workers[i].switches;
+    }
+    fiber_runtime_destroy(&rt);
+    assert(a1.balance == a1_expected && a1.balance + a2.balance == 2 * INIT_BALANCE);
+    printf("[fiber] transfers=%d workers=%d: %.0f transfers/s, %ld switches\n",
+           n, n_workers, n * 1e9 / fiber_ns, switches);
+
+    /* pthreads */
+    start = now_ns();
+    drive_threads(args, n);
+    uint64_t thread_ns = now_ns() - start;
+    assert(a1.balance == 2 * a1_expected - INIT_BALANCE && a1.balance + a2.balance == 2 * INIT_BALANCE);
+    printf("[pthread] transfers=%d: %.0f transfers/s, fibers %.1fx faster\n",
+           n, n * 1e9 / thread_ns, (double)thread_ns / fiber_ns);
+
+    printf("main end: a1's balance=%d, a2's balance=%d\n", a1.balance, a2.balance);
+
+    pthread_mutex_destroy(&a1.m);
+    pthread_mutex_destroy(&a2.m);
+    free(args);
+    return 0;
+}
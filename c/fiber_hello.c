@@ -0,0 +1,40 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fiber.h"
+
+/* hello.c on fibers: the N greeters are fibers on 2 worker pthreads */
+
+void *entry_point(void *arg) {
+  printf("Hello from fiber %d on worker %d\n", *(int *)arg, fiber_worker_id());
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  const int N = 8;
+  fiber_runtime_t rt;
+  fiber_t *f[N];
+  int args[N];
+
+  printf("main: begin\n");
+  fiber_runtime_init(&rt, 2);
+
+  // spawn N fibers
+  for (int i = 0; i < N; ++i) {
+    args[i] = i;
+    if ( (f[i] = fiber_spawn(&rt, entry_point, &args[i])) == NULL ) {
+      fprintf(stderr, "error: spawn failed.\n");
+      exit(1);
+    }
+  }
+
+  // join waits for the fibers to finish
+  for (int i = 0; i < N; ++i) {
+    fiber_join(f[i]);
+  }
+
+  fiber_runtime_destroy(&rt);
+  printf("main: end\n");
+  return 0;
+}
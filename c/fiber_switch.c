@@ -0,0 +1,160 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "fiber.h"
+#include "util.h"
+
+#define ROUND_TRIPS 10000 // spawn+join, a pthread_create is 1000x a switch
+
+typedef struct _pingpong_t {
+    long rounds;
+    int turn;          // the futex: whose turn it is, 0 or 1
+} pingpong_t;
+
+typedef struct _player_t {
+    pingpong_t* game;
+    int me;
+} player_t;
+
+/* pin the caller to cpu 0, so two players switch on one cpu instead of running side by side */
+void pin_cpu0() {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(0, &cpus);
+    assert( pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus) == 0 );
+}
+
+/*---------------------------- fibers ----------------------------*/
+
+void* fiber_player(void* arg) {
+    long rounds = *(long*)arg;
+    for (long i = 0; i < rounds; ++i) {
+        fiber_yield();
+    }
+    return NULL;
+}
+
+void* empty(void* arg) {
+    return NULL;
+}
+
+/* spawn and join one fiber at a time from a fiber, ROUND_TRIPS times */
+void* fiber_round_trips(void* arg) {
+    fiber_runtime_t* rt = (fiber_runtime_t*)arg;
+    for (int i = 0; i < ROUND_TRIPS; ++i) {
+        fiber_join(fiber_spawn(rt, empty, NULL));
+    }
+    return NULL;
+}
+
+/*!
+ * \brief two fibers on one worker yield to each other `rounds` times
+ * each; every yield is one switch
+ */
+void bench_fibers(long rounds) {
+    fiber_runtime_t rt;
+    fiber_runtime_init(&rt, 1);
+
+    uint64_t start = now_ns();
+    fiber_t* a = fiber_spawn(&rt, fiber_player, &rounds);
+    fiber_t* b = fiber_spawn(&rt, fiber_player, &rounds);
+    fiber_join(a);
+    fiber_join(b);
+    uint64_t elapsed = now_ns() - start;
+    printf("[fiber] yield ping-pong: %.1f ns per switch (%ld switches)\n",
+           (double)elapsed / rt.workers[0].switches, rt.workers[0].switches);
+
+    start = now_ns();
+    fiber_join(fiber_spawn(&rt, fiber_round_trips, &rt));
+    elapsed = now_ns() - start;
+    printf("[fiber] spawn+join round trip: %.0f ns\n", (double)elapsed / ROUND_TRIPS);
+    fiber_runtime_destroy(&rt);
+}
+
+/*---------------------------- pthreads ----------------------------*/
+
+/* take turns through a futex: wait for our turn, hand it over, wake the other */
+void* futex_player(void* arg) {
+    pingpong_t* game = ((player_t*)arg)->game;
+    const int me = ((player_t*)arg)->me;
+    pin_cpu0();
+    for (long i = 0; i < game->rounds; ++i) {
+        while (__atomic_load_n(&game->turn, __ATOMIC_ACQUIRE) != me) {
+            syscall(SYS_futex, &game->turn, FUTEX_WAIT_PRIVATE, 1 - me, NULL, NULL, 0);
+        }
+        __atomic_store_n(&game->turn, 1 - me, __ATOMIC_RELEASE);
+        syscall(SYS_futex, &game->turn, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+    return NULL;
+}
+
+void* yield_player(void* arg) {
+    pingpong_t* game = ((player_t*)arg)->game;
+    pin_cpu0();
+    for (long i = 0; i < game->rounds; ++i) {
+        sched_yield();
+    }
+    return NULL;
+}
+
+void* thread_empty(void* arg) {
+    return NULL;
+}
+
+/* two pthreads on the same cpu, `rounds` turns each, one switch per turn */
+void pingpong(const char* what, void* (*player)(void*), long rounds) {
+    pingpong_t game = { rounds, 0 };
+    player_t players[2] = { { &game, 0 }, { &game, 1 } };
+    pthread_t threads[2];
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < 2; ++i) {
+        assert( pthread_create(&threads[i], NULL, player, &players[i]) == 0 );
+    }
+    for (int i = 0; i < 2; ++i) {
+        assert( pthread_join(threads[i], NULL) == 0 );
+    }
+    uint64_t elapsed = now_ns() - start;
+    printf("[pthread] %s ping-pong: %.1f ns per switch\n", what, (double)elapsed / (2 * rounds));
+}
+
+void bench_threads(long rounds) {
+    pingpong("futex", futex_player, rounds);
+    pingpong("sched_yield", yield_player, rounds);
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < ROUND_TRIPS; ++i) {
+        pthread_t t;
+        assert( pthread_create(&t, NULL, thread_empty, NULL) == 0 );
+        assert( pthread_join(t, NULL) == 0 );
+    }
+    printf("[pthread] create+join round trip: %.0f ns\n", (double)(now_ns() - start) / ROUND_TRIPS);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 2) {
+        printf("Usage: %s [<rounds>]\n"
+               "Time the switch between two fibers yielding to each other, and between two pthreads "
+               "on one cpu passing a futex or calling sched_yield, <rounds> turns each; then the "
+               "spawn+join round trip of both.\n", argv[0]);
+        exit(1);
+    }
+    const long rounds = argc == 2 ? atol(argv[1]) : 1000000;
+    if (rounds < 1) {
+        printf("Error: invalid arguments.\n");
+        exit(1);
+    }
+    bench_fibers(rounds);
+    bench_threads(rounds);
+    return 0;
+}
@@ -0,0 +1,96 @@
+/*
+ * Futures with inline storage: the result of a task goes into a slot the
+ * caller owns (on its stack, in an array reused across batches), one
+ * cache line holding the state word and up to FUTURE_VALUE_SIZE bytes of
+ * value. No malloc per result like return_stack_ptr.c, and no join: the
+ * producer copies the value in and flips the state, the consumer spins a
+ * little, yields a few times (the producer may need its CPU) and then
+ * sleeps on the state word with a futex. The producer only makes the
+ * FUTEX_WAKE system call when somebody went to sleep.
+ */
+#ifndef FUTURE_H
+#define FUTURE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sched.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#ifndef CACHE_LINE
+#define CACHE_LINE 64
+#endif
+
+#define FUTURE_SPIN_LIMIT 128                   // polls before the consumer yields the CPU
+#define FUTURE_YIELD_LIMIT 16                   // sched_yields before it sleeps on the futex
+#define FUTURE_VALUE_SIZE (CACHE_LINE - 8)      // inline bytes next to the state word
+
+typedef enum {
+    FUTURE_EMPTY,
+    FUTURE_WAITING, // empty, and a consumer sleeps on `state`
+    FUTURE_READY,
+} future_state_t;
+
+typedef struct _future_t {
+    uint32_t state; // future_state_t, the futex word
+    uint32_t size;  // bytes of `value` set
+    char value[FUTURE_VALUE_SIZE];
+} __attribute__((aligned(CACHE_LINE))) future_t;
+
+/* empty, also to reuse a future once its value was consumed */
+static inline void future_init(future_t* f) {
+    __atomic_store_n(&f->state, FUTURE_EMPTY, __ATOMIC_RELAXED);
+    f->size = 0;
+}
+
+static inline int future_ready(future_t* f) {
+    return __atomic_load_n(&f->state, __ATOMIC_ACQUIRE) == FUTURE_READY;
+}
+
+/*!
+ * \brief the promise side: copy `size` bytes of result in and publish
+ * them. Exactly once per `future_init`.
+ */
+static inline void future_set(future_t* f, const void* value, size_t size) {
+    assert(size <= FUTURE_VALUE_SIZE);
+    memcpy(f->value, value, size);
+    f->size = (uint32_t)size;
+    if (__atomic_exchange_n(&f->state, FUTURE_READY, __ATOMIC_ACQ_REL) == FUTURE_WAITING) {
+        syscall(SYS_futex, &f->state, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/*!
+ * \brief wait for the value and return a pointer to it, valid until the
+ * next `future_init`
+ */
+static inline const void* future_wait(future_t* f) {
+    for (int spins = 0; spins < FUTURE_SPIN_LIMIT; ++spins) {
+        if (future_ready(f)) {
+            return f->value;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+    for (int yields = 0; yields < FUTURE_YIELD_LIMIT; ++yields) {
+        sched_yield();
+        if (future_ready(f)) {
+            return f->value;
+        }
+    }
+    uint32_t state = FUTURE_EMPTY;
+    if (!__atomic_compare_exchange_n(&f->state, &state, FUTURE_WAITING, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE) &&
+        state == FUTURE_READY) {
+        return f->value;
+    }
+    while (__atomic_load_n(&f->state, __ATOMIC_ACQUIRE) != FUTURE_READY) {
+        syscall(SYS_futex, &f->state, FUTEX_WAIT_PRIVATE, FUTURE_WAITING, NULL, NULL, 0);
+    }
+    return f->value;
+}
+
+#endif /* FUTURE_H */
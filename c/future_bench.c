@@ -0,0 +1,193 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <assert.h>
+#include <time.h>
+#include <sys/sysinfo.h>
+
+#define CACHE_LINE 64
+#define RING_CAPACITY 1024 // tasks in flight, a power of two
+#define BATCH 256          // tasks submitted before the caller waits for their results
+#define THREAD_TASKS 10000 // the thread-per-task pattern is 100x slower, fewer tasks
+
+#include "mpmc_ring.h"
+#include "future.h"
+#include "util.h"
+
+typedef enum {
+    RESULT_THREAD_MALLOC, // return_stack_ptr.c: a thread per task, malloc in it, join and free
+    RESULT_POOL_MALLOC,   // pool workers malloc the result and publish the pointer, the caller frees
+    RESULT_POOL_FUTURE,   // pool workers write into the caller's future
+    N_RESULTS,
+} result_kind_t;
+
+static const char* result_names[N_RESULTS] = { "thread-malloc", "pool-malloc", "pool-future" };
+
+typedef struct _arg_t {
+    int a;
+    int b;
+} arg_t;
+
+typedef struct _ret_t {
+    int x;
+    int y;
+} ret_t;
+
+/* what the pool workers dequeue: the argument and where the result goes */
+typedef struct _task_t {
+    arg_t arg;
+    future_t* future;  // RESULT_POOL_FUTURE
+    ret_t** ret;       // RESULT_POOL_MALLOC, NULL until the result is there
+} task_t;
+
+typedef struct _pool_t {
+    mpmc_ring_t ring;
+    int stop;
+} pool_t;
+
+ret_t compute(const arg_t* arg) {
+    ret_t r = { arg->a + arg->b, arg->a * arg->b };
+    return r;
+}
+
+/* `entry_point` of return_stack_ptr.c without the printf */
+void* entry_point(void* arg) {
+    ret_t* r = (ret_t*)malloc(sizeof(ret_t));
+    *r = compute((arg_t*)arg);
+    return (void*)r;
+}
+
+void* pool_worker(void* arg) {
+    pool_t* pool = (pool_t*)arg;
+    task_t task;
+    for (;;) {
+        if (!mpmc_dequeue(&pool->ring, &task)) {
+            if (__atomic_load_n(&pool->stop, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            sched_yield(); // empty, let the caller run
+            continue;
+        }
+        ret_t r = compute(&task.arg);
+        if (task.future) {
+            future_set(task.future, &r, sizeof(ret_t));
+        } else {
+            ret_t* p = (ret_t*)malloc(sizeof(ret_t));
+            *p = r;
+            __atomic_store_n(task.ret, p, __ATOMIC_RELEASE);
+        }
+    }
+    return NULL;
+}
+
+void check(const arg_t* arg, const ret_t* r) {
+    assert(r->x == arg->a + arg->b && r->y == arg->a * arg->b);
+}
+
+/*!
+ * \brief run `n` tasks in batches of BATCH and collect every result, the
+ * pools with `n_workers` workers; return the elapsed ns
+ */
+uint64_t run(result_kind_t kind, long n, int n_workers) {
+    arg_t args[BATCH];
+    pthread_t threads[BATCH];
+    future_t futures[BATCH];  // caller-owned, reused by every batch
+    ret_t* rets[BATCH];
+    pool_t pool;
+    pthread_t workers[n_workers];
+
+    if (kind != RESULT_THREAD_MALLOC) {
+        mpmc_ring_init(&pool.ring, RING_CAPACITY, sizeof(task_t));
+        pool.stop = 0;
+        for (int i = 0; i < n_workers; ++i) {
+            assert( pthread_create(&workers[i], NULL, pool_worker, &pool) == 0 );
+        }
+    }
+
+    uint64_t start = now_ns();
+    for (long done = 0; done < n; ) {
+        int k = n - done < BATCH ? n - done : BATCH;
+        for (int i = 0; i < k; ++i) {
+            args[i].a = done + i;
+            args[i].b = i;
+            if (kind == RESULT_THREAD_MALLOC) {
+                assert( pthread_create(&threads[i], NULL, entry_point, &args[i]) == 0 );
+                continue;
+            }
+            task_t task = { args[i], NULL, NULL };
+            if (kind == RESULT_POOL_FUTURE) {
+                future_init(&futures[i]);
+                task.future = &futures[i];
+            } else {
+                rets[i] = NULL;
+                task.ret = &rets[i];
+            }
+            while (!mpmc_enqueue(&pool.ring, &task)) {
+                sched_yield(); // full, let the workers run
+            }
+        }
+        for (int i = 0; i < k; ++i) {
+            ret_t* r;
+            switch (kind) {
+            case RESULT_THREAD_MALLOC:
+                assert( pthread_join(threads[i], (void**)&r) == 0 );
+                check(&args[i], r);
+                free(r);
+                break;
+            case RESULT_POOL_MALLOC:
+                while (!(r = __atomic_load_n(&rets[i], __ATOMIC_ACQUIRE))) {
+                    sched_yield();
+                }
+                check(&args[i], r);
+                free(r);
+                break;
+            default:
+                check(&args[i], (const ret_t*)future_wait(&futures[i]));
+                break;
+            }
+        }
+        done += k;
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    if (kind != RESULT_THREAD_MALLOC) {
+        __atomic_store_n(&pool.stop, 1, __ATOMIC_RELEASE);
+        for (int i = 0; i < n_workers; ++i) {
+            assert( pthread_join(workers[i], NULL) == 0 );
+        }
+        mpmc_ring_destroy(&pool.ring);
+    }
+    return elapsed;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 4) {
+        printf("Usage: %s [<tasks> [<workers> [<result>]]]\n"
+               "  result: thread-malloc, pool-malloc or pool-future\n"
+               "Run <tasks> tiny tasks (at most %d with thread-malloc) and collect their results, "
+               "for every way of returning them or only <result>.\n", argv[0], THREAD_TASKS);
+        exit(1);
+    }
+    const long n = argc >= 2 ? atol(argv[1]) : 1000000;
+    const int n_workers = argc >= 3 ? atoi(argv[2]) : get_nprocs();
+    result_kind_t only = argc == 4 ? find_name(result_names, N_RESULTS, argv[3]) : N_RESULTS;
+    if (n < 1 || n_workers < 1 || (argc == 4 && only == N_RESULTS)) {
+        printf("Error: invalid arguments.\n");
+        exit(1);
+    }
+
+    for (result_kind_t kind = 0; kind < N_RESULTS; ++kind) {
+        if (only != N_RESULTS && kind != only) {
+            continue;
+        }
+        long tasks = kind == RESULT_THREAD_MALLOC && n > THREAD_TASKS ? THREAD_TASKS : n;
+        uint64_t elapsed = run(kind, tasks, n_workers);
+        printf("[%s] tasks=%ld workers=%d: %.0f tasks/s, %.0f ns per result\n", result_names[kind],
+               tasks, kind == RESULT_THREAD_MALLOC ? 0 : n_workers, tasks * 1e9 / elapsed, (double)elapsed / tasks);
+    }
+    return 0;
+}
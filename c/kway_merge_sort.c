@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <assert.h>
 #include <limits.h>
 #include <pthread.h>
@@ -8,6 +9,8 @@
 #include <time.h>
 #include <math.h>
 
+#include "trace.h"
+
 typedef struct _data {
   int *arr;
   int *tmp;
@@ -95,6 +98,16 @@ void kway_merge(int *arr, int *tmp, int *sep, int k) {
   }
 }
 
+void *kway_mergesort(void *arg);
+
+/* the entry point of the worker threads: their sorts are the traced tasks */
+void *kway_mergesort_thread(void *arg) {
+  trace_point("sort");
+  kway_mergesort(arg);
+  trace_point("sorted");
+  return NULL;
+}
+
 void *kway_mergesort(void *arg) {
   data_t *data = (data_t *)(arg);
   int *arr = data->arr;
@@ -148,7 +161,7 @@ void *kway_mergesort(void *arg) {
 
       /* create k threads */
       for (int i=0; i<k; ++i) {
-        if ( pthread_create(&ph[i], NULL, kway_mergesort, (void *)&args[i]) != 0 )
+        if ( pthread_create(&ph[i], NULL, kway_mergesort_thread, (void *)&args[i]) != 0 )
         {
           fprintf(stderr, "pthread_create failed.");
           exit(1);
@@ -161,6 +174,7 @@ void *kway_mergesort(void *arg) {
           fprintf(stderr, "pthread_join failed.");
         }
       }
+      trace_point("merge");
     }
 
     /* merge the sorted arrays */
@@ -205,7 +219,7 @@ int main(int argc, char *argv[]) {
   clock_gettime(CLOCK_MONOTONIC_RAW, &start);
 
   data_t arg = {arr, tmp, 0, num, k, threshold};
-  kway_mergesort((void *)&arg);
+  kway_mergesort_thread((void *)&arg);
 
   clock_gettime(CLOCK_MONOTONIC_RAW, &end);
   printf("End timing.\n");
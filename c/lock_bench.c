@@ -0,0 +1,338 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/sysinfo.h>
+
+#define CACHE_LINE 64
+#define HIST_BUCKETS 32   // log2(ns) buckets, the last one also counts everything longer
+#define RUN_MS 200        // how long each point of the sweep runs
+
+#include "qlock.h"
+#include "util.h"
+
+/*---------------------------- futex lock ----------------------------*/
+
+/* 0: unlocked, 1: locked, 2: locked and maybe waiters ("Futexes Are Tricky", mutex 2) */
+typedef struct _futex_lock_t {
+    int state;
+} futex_lock_t;
+
+static long futex(int* uaddr, int op, int val) {
+    return syscall(SYS_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+void futex_lock(futex_lock_t* l) {
+    int c = 0;
+    if (__atomic_compare_exchange_n(&l->state, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;
+    }
+    if (c != 2) {
+        c = __atomic_exchange_n(&l->state, 2, __ATOMIC_ACQUIRE);
+    }
+    while (c != 0) {
+        futex(&l->state, FUTEX_WAIT_PRIVATE, 2);
+        c = __atomic_exchange_n(&l->state, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+void futex_unlock(futex_lock_t* l) {
+    if (__atomic_fetch_sub(&l->state, 1, __ATOMIC_RELEASE) != 1) {
+        __atomic_store_n(&l->state, 0, __ATOMIC_RELEASE);
+        futex(&l->state, FUTEX_WAKE_PRIVATE, 1);
+    }
+}
+
+/*---------------------------- the locks under test ----------------------------*/
+
+typedef enum {
+    LOCK_MUTEX,    // pthread_mutex_t, PTHREAD_MUTEX_NORMAL
+    LOCK_ADAPTIVE, // pthread_mutex_t, PTHREAD_MUTEX_ADAPTIVE_NP: spins a bit before sleeping
+    LOCK_SPIN,     // pthread_spinlock_t
+    LOCK_TICKET,
+    LOCK_MCS,
+    LOCK_RWLOCK,   // pthread_rwlock_t, every operation takes the write lock
+    LOCK_FUTEX,
+    LOCK_CLH,
+    LOCK_COHORT,   // ticket locks per node and global, see qlock.h
+    N_LOCKS,
+} lock_kind_t;
+
+static const char* lock_names[N_LOCKS] = { "mutex", "adaptive", "spin", "ticket", "mcs", "rwlock", "futex", "clh", "cohort" };
+
+typedef struct _bench_lock_t {
+    lock_kind_t kind;
+    pthread_mutex_t mutex;
+    pthread_spinlock_t spin;
+    ticket_lock_t ticket;
+    mcs_lock_t mcs;
+    pthread_rwlock_t rwlock;
+    futex_lock_t futex;
+    clh_lock_t clh;
+    cohort_lock_t cohort;
+    handoff_stats_t handoffs; // updated under the lock
+} bench_lock_t;
+
+/* what a thread brings to the queue locks */
+typedef struct _lock_ctx_t {
+    mcs_node_t mcs;
+    clh_handle_t clh;
+    int node; // the NUMA node of the current acquisition
+} lock_ctx_t;
+
+void bench_lock_init(bench_lock_t* l, lock_kind_t kind) {
+    memset(l, 0, sizeof(bench_lock_t));
+    l->kind = kind;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, kind == LOCK_ADAPTIVE ? PTHREAD_MUTEX_ADAPTIVE_NP : PTHREAD_MUTEX_NORMAL);
+    pthread_mutex_init(&l->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    pthread_spin_init(&l->spin, PTHREAD_PROCESS_PRIVATE);
+    pthread_rwlock_init(&l->rwlock, NULL);
+    clh_init(&l->clh);
+    cohort_init(&l->cohort, qlock_n_nodes(), COHORT_MAX_PASSES);
+    handoff_stats_init(&l->handoffs);
+}
+
+void bench_lock_destroy(bench_lock_t* l) {
+    pthread_mutex_destroy(&l->mutex);
+    pthread_spin_destroy(&l->spin);
+    pthread_rwlock_destroy(&l->rwlock);
+    clh_destroy(&l->clh);
+    cohort_destroy(&l->cohort);
+}
+
+/* also counts the handoffs between NUMA nodes, for every kind of lock */
+static inline void bench_lock(bench_lock_t* l, lock_ctx_t* ctx) {
+    ctx->node = qlock_current_node();
+    switch (l->kind) {
+    case LOCK_MUTEX:
+    case LOCK_ADAPTIVE: pthread_mutex_lock(&l->mutex); break;
+    case LOCK_SPIN:     pthread_spin_lock(&l->spin); break;
+    case LOCK_TICKET:   ticket_lock(&l->ticket); break;
+    case LOCK_MCS:      mcs_lock(&l->mcs, &ctx->mcs); break;
+    case LOCK_RWLOCK:   pthread_rwlock_wrlock(&l->rwlock); break;
+    case LOCK_FUTEX:    futex_lock(&l->futex); break;
+    case LOCK_CLH:      clh_lock(&l->clh, &ctx->clh); break;
+    case LOCK_COHORT:   cohort_lock(&l->cohort, ctx->node); break;
+    default:            assert(0);
+    }
+    handoff_note(&l->handoffs, ctx->node);
+}
+
+static inline void bench_unlock(bench_lock_t* l, lock_ctx_t* ctx) {
+    switch (l->kind) {
+    case LOCK_MUTEX:
+    case LOCK_ADAPTIVE: pthread_mutex_unlock(&l->mutex); break;
+    case LOCK_SPIN:     pthread_spin_unlock(&l->spin); break;
+    case LOCK_TICKET:   ticket_unlock(&l->ticket); break;
+    case LOCK_MCS:      mcs_unlock(&l->mcs, &ctx->mcs); break;
+    case LOCK_RWLOCK:   pthread_rwlock_unlock(&l->rwlock); break;
+    case LOCK_FUTEX:    futex_unlock(&l->futex); break;
+    case LOCK_CLH:      clh_unlock(&l->clh, &ctx->clh); break;
+    case LOCK_COHORT:   cohort_unlock(&l->cohort, ctx->node); break;
+    default:            assert(0);
+    }
+}
+
+/*---------------------------- benchmark ----------------------------*/
+
+typedef struct _thread_stats_t {
+    long ops;
+    long wait_hist[HIST_BUCKETS]; // time from asking for the lock to holding it
+    long hold_hist[HIST_BUCKETS]; // time from holding the lock to releasing it
+} __attribute__((aligned(CACHE_LINE))) thread_stats_t;
+
+typedef struct _bench_t {
+    bench_lock_t lock;
+    int cs;               // counter increments inside the critical section
+    int think;            // spin iterations between two critical sections
+    volatile int stop;
+    thread_stats_t* stats;
+} bench_t;
+
+static volatile long counter = 0;
+
+typedef struct _worker_arg_t {
+    bench_t* bench;
+    int id;
+} worker_arg_t;
+
+static inline int hist_bucket(uint64_t ns) {
+    int b = ns ? 64 - __builtin_clzll(ns) : 0;
+    return b < HIST_BUCKETS ? b : HIST_BUCKETS - 1;
+}
+
+void* worker(void* arg) {
+    bench_t* bench = ((worker_arg_t*)arg)->bench;
+    thread_stats_t* stats = &bench->stats[((worker_arg_t*)arg)->id];
+    lock_ctx_t ctx;
+    clh_handle_init(&ctx.clh);
+
+    while (!bench->stop) {
+        uint64_t t0 = now_ns();
+        bench_lock(&bench->lock, &ctx);
+        uint64_t t1 = now_ns();
+        for (int i = 0; i < bench->cs; ++i) {
+            counter += 1;
+        }
+        uint64_t t2 = now_ns();
+        bench_unlock(&bench->lock, &ctx);
+
+        ++stats->ops;
+        ++stats->wait_hist[hist_bucket(t1 - t0)];
+        ++stats->hold_hist[hist_bucket(t2 - t1)];
+
+        for (volatile int i = 0; i < bench->think; ++i) {
+        }
+    }
+    clh_handle_destroy(&ctx.clh);
+    return NULL;
+}
+
+/* the smallest bucket bound below which `p` of the samples fall */
+uint64_t hist_percentile(const long* hist, long n, double p) {
+    long seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; ++b) {
+        seen += hist[b];
+        if (seen >= n * p) {
+            return 1ull << b;
+        }
+    }
+    return 1ull << (HIST_BUCKETS - 1);
+}
+
+void print_hist(const char* name, const long* hist, long n) {
+    printf("\t%s time (ns):\n", name);
+    for (int b = 0; b < HIST_BUCKETS; ++b) {
+        if (hist[b]) {
+            printf("\t\t< %-10llu %10ld %5.1f%%\n", 1ull << b, hist[b], hist[b] * 100.0 / n);
+        }
+    }
+}
+
+/*!
+ * \brief run `n_threads` workers on one lock for `ms` milliseconds and
+ * report the throughput, the per-thread op counts (min/max and Jain's
+ * fairness index, 1 is perfectly fair), the wait/hold times and how
+ * often the lock moved to a thread on another NUMA node
+ */
+void run(lock_kind_t kind, int n_threads, int cs, int think, int ms, int verbose) {
+    bench_t bench;
+    pthread_t threads[n_threads];
+    worker_arg_t args[n_threads];
+
+    bench_lock_init(&bench.lock, kind);
+    bench.cs = cs;
+    bench.think = think;
+    bench.stop = 0;
+    bench.stats = (thread_stats_t*)aligned_alloc(CACHE_LINE, n_threads * sizeof(thread_stats_t));
+    assert(bench.stats);
+    memset(bench.stats, 0, n_threads * sizeof(thread_stats_t));
+    counter = 0;
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < n_threads; ++i) {
+        args[i].bench = &bench;
+        args[i].id = i;
+        if ( pthread_create(&threads[i], NULL, worker, &args[i]) != 0 )
+        {
+            fprintf(stderr, "pthread_create failed.\n");
+            exit(1);
+        }
+    }
+    struct timespec duration = { ms / 1000, ms % 1000 * 1000000l };
+    nanosleep(&duration, NULL);
+    bench.stop = 1;
+    for (int i = 0; i < n_threads; ++i) {
+        assert( pthread_join(threads[i], NULL) == 0 );
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    long total = 0, min_ops = bench.stats[0].ops, max_ops = 0;
+    double sum_sq = 0;
+    long wait_hist[HIST_BUCKETS] = { 0 }, hold_hist[HIST_BUCKETS] = { 0 };
+    for (int i = 0; i < n_threads; ++i) {
+        thread_stats_t* s = &bench.stats[i];
+        total += s->ops;
+        sum_sq += (double)s->ops * s->ops;
+        min_ops = s->ops < min_ops ? s->ops : min_ops;
+        max_ops = s->ops > max_ops ? s->ops : max_ops;
+        for (int b = 0; b < HIST_BUCKETS; ++b) {
+            wait_hist[b] += s->wait_hist[b];
+            hold_hist[b] += s->hold_hist[b];
+        }
+    }
+    /* the lock is the only thing that keeps the increments from getting lost */
+    assert(counter == total * cs);
+
+    printf("[%s] threads=%d cs=%d think=%d: %.2f M ops/s, per-thread ops min %ld max %ld, fairness %.3f, "
+           "wait p50 < %lu ns p99 < %lu ns, hold p50 < %lu ns p99 < %lu ns, cross-node handoffs %ld\n",
+           lock_names[kind], n_threads, cs, think, total * 1e3 / elapsed, min_ops, max_ops,
+           sum_sq > 0 ? (double)total * total / (n_threads * sum_sq) : 0,
+           hist_percentile(wait_hist, total, 0.5), hist_percentile(wait_hist, total, 0.99),
+           hist_percentile(hold_hist, total, 0.5), hist_percentile(hold_hist, total, 0.99), bench.lock.handoffs.cross_node);
+    if (verbose) {
+        for (int i = 0; i < n_threads; ++i) {
+            printf("\tthread %d: %ld ops\n", i, bench.stats[i].ops);
+        }
+        print_hist("wait", wait_hist, total);
+        print_hist("hold", hold_hist, total);
+    }
+
+    free(bench.stats);
+    bench_lock_destroy(&bench.lock);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 1 && argc != 5 && argc != 6) {
+        printf("Usage: %s [<lock> <threads> <cs> <think> [<ms>]]\n"
+               "  lock: mutex, adaptive, spin, ticket, mcs, rwlock, futex, clh or cohort\n"
+               "  cs: counter increments inside the critical section\n"
+               "  think: spin iterations between two critical sections\n"
+               "One point prints the per-thread op counts and the wait/hold histograms. "
+               "Without arguments, sweep every lock, the threads from 1 to all cores, "
+               "cs over 1, 10 and 100 and think over 0, 100 and 1000.\n", argv[0]);
+        exit(1);
+    }
+
+    if (argc >= 5) {
+        lock_kind_t kind = find_name(lock_names, N_LOCKS, argv[1]);
+        const int n_threads = atoi(argv[2]);
+        const int cs = atoi(argv[3]);
+        const int think = atoi(argv[4]);
+        const int ms = argc == 6 ? atoi(argv[5]) : RUN_MS;
+        if (kind == N_LOCKS || n_threads < 1 || cs < 0 || think < 0 || ms < 1) {
+            printf("Error: invalid arguments.\n");
+            exit(1);
+        }
+        run(kind, n_threads, cs, think, ms, 1);
+        return 0;
+    }
+
+    const int nprocs = get_nprocs();
+    const int css[] = { 1, 10, 100 };
+    const int thinks[] = { 0, 100, 1000 };
+    for (int c = 0; c < sizeof(css) / sizeof(css[0]); ++c) {
+        for (int t = 0; t < sizeof(thinks) / sizeof(thinks[0]); ++t) {
+            for (int k = 1; ; k = k * 2 < nprocs ? k * 2 : nprocs) {
+                for (lock_kind_t kind = 0; kind < N_LOCKS; ++kind) {
+                    run(kind, k, css[c], thinks[t], RUN_MS, 0);
+                }
+                if (k == nprocs) {
+                    break;
+                }
+            }
+        }
+    }
+    return 0;
+}
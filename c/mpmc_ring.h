@@ -0,0 +1,181 @@
+/*
+ * A bounded multi-producer/multi-consumer ring (Dmitry Vyukov's
+ * algorithm): every cell carries a sequence number telling which lap of
+ * the ring it is ready for, so producers and consumers only contend on
+ * the enqueue/dequeue positions, each on its own cache line. Elements
+ * are copied in and out by value.
+ */
+#ifndef MPMC_RING_H
+#define MPMC_RING_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sched.h>
+
+#ifndef CACHE_LINE
+#define CACHE_LINE 64
+#endif
+
+#define MPMC_SPIN_LIMIT 1024 // spins on a claimed cell before yielding the CPU
+
+typedef struct _mpmc_ring_t {
+    size_t enqueue_pos __attribute__((aligned(CACHE_LINE)));
+    size_t dequeue_pos __attribute__((aligned(CACHE_LINE)));
+    char* cells __attribute__((aligned(CACHE_LINE)));
+    size_t mask;        // capacity - 1
+    size_t elem_size;
+    size_t cell_size;   // seq + element, rounded up to whole cache lines
+} mpmc_ring_t;
+
+/* the sequence number at the start of cell `pos` */
+static inline size_t* mpmc_cell_seq(mpmc_ring_t* r, size_t pos) {
+    return (size_t*)(r->cells + (pos & r->mask) * r->cell_size);
+}
+
+static inline void* mpmc_cell_data(mpmc_ring_t* r, size_t pos) {
+    return r->cells + (pos & r->mask) * r->cell_size + sizeof(size_t);
+}
+
+/*!
+ * \brief a ring of `capacity` elements of `elem_size` bytes; every cell
+ * takes whole cache lines, so neighbor cells written by different
+ * threads never false share
+ *
+ * \param capacity, a power of two
+ */
+static inline void mpmc_ring_init(mpmc_ring_t* r, size_t capacity, size_t elem_size) {
+    assert(capacity >= 2 && (capacity & (capacity - 1)) == 0);
+    r->elem_size = elem_size;
+    r->cell_size = (sizeof(size_t) + elem_size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    r->mask = capacity - 1;
+    r->cells = (char*)aligned_alloc(CACHE_LINE, capacity * r->cell_size);
+    assert(r->cells);
+    for (size_t i = 0; i < capacity; ++i) {
+        *mpmc_cell_seq(r, i) = i;
+    }
+    r->enqueue_pos = 0;
+    r->dequeue_pos = 0;
+}
+
+static inline void mpmc_ring_destroy(mpmc_ring_t* r) {
+    free(r->cells);
+}
+
+/* returns 0 if the ring is full */
+static inline int mpmc_enqueue(mpmc_ring_t* r, const void* elem) {
+    size_t pos = __atomic_load_n(&r->enqueue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        size_t seq = __atomic_load_n(mpmc_cell_seq(r, pos), __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&r->enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return 0; // the cell still holds an element of the previous lap
+        } else {
+            pos = __atomic_load_n(&r->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    memcpy(mpmc_cell_data(r, pos), elem, r->elem_size);
+    __atomic_store_n(mpmc_cell_seq(r, pos), pos + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/* returns 0 if the ring is empty */
+static inline int mpmc_dequeue(mpmc_ring_t* r, void* elem) {
+    size_t pos = __atomic_load_n(&r->dequeue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        size_t seq = __atomic_load_n(mpmc_cell_seq(r, pos), __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&r->dequeue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return 0; // no producer has filled the cell yet
+        } else {
+            pos = __atomic_load_n(&r->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    memcpy(elem, mpmc_cell_data(r, pos), r->elem_size);
+    __atomic_store_n(mpmc_cell_seq(r, pos), pos + r->mask + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/*
+ * The batch operations claim up to `n` consecutive positions with one
+ * CAS, then fill or drain them. A claimed cell may still be in use by a
+ * peer of the previous lap (a consumer still copying out, or a producer
+ * still copying in), so they wait for it; that wait is bounded by the
+ * peer's copy, but it makes the batch operations blocking, unlike the
+ * single-element ones.
+ */
+
+static inline void mpmc_wait_seq(mpmc_ring_t* r, size_t pos, size_t seq) {
+    for (int spins = 0; __atomic_load_n(mpmc_cell_seq(r, pos), __ATOMIC_ACQUIRE) != seq; ++spins) {
+        if (spins == MPMC_SPIN_LIMIT) {
+            sched_yield();
+            spins = 0;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+}
+
+/* enqueue up to `n` elements of `elems`, returns how many */
+static inline size_t mpmc_enqueue_batch(mpmc_ring_t* r, const void* elems, size_t n) {
+    size_t pos = __atomic_load_n(&r->enqueue_pos, __ATOMIC_RELAXED);
+    size_t k;
+    for (;;) {
+        intptr_t used = (intptr_t)(pos - __atomic_load_n(&r->dequeue_pos, __ATOMIC_ACQUIRE));
+        if (used < 0) {
+            // `pos` is stale, the consumers already moved past it
+            pos = __atomic_load_n(&r->enqueue_pos, __ATOMIC_RELAXED);
+            continue;
+        }
+        size_t room = (size_t)used < r->mask + 1 ? r->mask + 1 - used : 0;
+        k = n < room ? n : room;
+        if (k == 0) {
+            return 0;
+        }
+        if (__atomic_compare_exchange_n(&r->enqueue_pos, &pos, pos + k, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < k; ++i) {
+        mpmc_wait_seq(r, pos + i, pos + i);
+        memcpy(mpmc_cell_data(r, pos + i), (const char*)elems + i * r->elem_size, r->elem_size);
+        __atomic_store_n(mpmc_cell_seq(r, pos + i), pos + i + 1, __ATOMIC_RELEASE);
+    }
+    return k;
+}
+
+/* dequeue up to `n` elements into `elems`, returns how many */
+static inline size_t mpmc_dequeue_batch(mpmc_ring_t* r, void* elems, size_t n) {
+    size_t pos = __atomic_load_n(&r->dequeue_pos, __ATOMIC_RELAXED);
+    size_t k;
+    for (;;) {
+        intptr_t avail = (intptr_t)(__atomic_load_n(&r->enqueue_pos, __ATOMIC_ACQUIRE) - pos);
+        if (avail <= 0) {
+            return 0;
+        }
+        k = n < (size_t)avail ? n : (size_t)avail;
+        if (__atomic_compare_exchange_n(&r->dequeue_pos, &pos, pos + k, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < k; ++i) {
+        mpmc_wait_seq(r, pos + i, pos + i + 1);
+        memcpy((char*)elems + i * r->elem_size, mpmc_cell_data(r, pos + i), r->elem_size);
+        __atomic_store_n(mpmc_cell_seq(r, pos + i), pos + i + r->mask + 1, __ATOMIC_RELEASE);
+    }
+    return k;
+}
+
+#endif /* MPMC_RING_H */
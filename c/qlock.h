@@ -0,0 +1,259 @@
+/*
+ * Queue locks shared by the counter and bank examples: a ticket lock,
+ * the MCS and CLH queue locks, and a NUMA cohort lock built from ticket
+ * locks. Everything is static inline, so a program only has to include
+ * this header (with _GNU_SOURCE defined, for getcpu).
+ */
+#ifndef QLOCK_H
+#define QLOCK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <assert.h>
+
+#ifndef CACHE_LINE
+#define CACHE_LINE 64
+#endif
+
+#define QLOCK_SPIN_LIMIT 1024        // spins before a spinning waiter yields the CPU
+#define COHORT_MAX_PASSES 64         // default bound on the local handoffs of a cohort
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/* spin on a condition, but yield once in a while so an oversubscribed machine makes progress */
+#define SPIN_UNTIL(cond) \
+    for (int spins = 0; !(cond); ++spins) { \
+        if (spins < QLOCK_SPIN_LIMIT) { \
+            cpu_relax(); \
+        } else { \
+            sched_yield(); \
+            spins = 0; \
+        } \
+    }
+
+/* the NUMA node the calling thread runs on, getcpu is a vDSO call */
+static inline int qlock_current_node() {
+    unsigned cpu, node;
+    if (getcpu(&cpu, &node) != 0) {
+        return 0;
+    }
+    return (int)node;
+}
+
+/* the number of possible NUMA nodes, 1 when the kernel does not say */
+static inline int qlock_n_nodes() {
+    int first = 0, last = 0;
+    FILE* f = fopen("/sys/devices/system/node/possible", "r");
+    if (!f) {
+        return 1;
+    }
+    int n = fscanf(f, "%d-%d", &first, &last);
+    fclose(f);
+    return n == 2 ? last + 1 : first + 1;
+}
+
+/*---------------------------- handoff counting ----------------------------*/
+
+/* updated by the lock holder only, so it needs no synchronization of its own */
+typedef struct _handoff_stats_t {
+    int last_node;   // the node of the previous holder, -1 before the first acquisition
+    long acquisitions;
+    long cross_node; // acquisitions on another node than the previous one
+} handoff_stats_t;
+
+static inline void handoff_stats_init(handoff_stats_t* s) {
+    s->last_node = -1;
+    s->acquisitions = 0;
+    s->cross_node = 0;
+}
+
+/* call right after taking the lock, `node` is the holder's node */
+static inline void handoff_note(handoff_stats_t* s, int node) {
+    ++s->acquisitions;
+    if (s->last_node != -1 && s->last_node != node) {
+        ++s->cross_node;
+    }
+    s->last_node = node;
+}
+
+/*---------------------------- ticket lock ----------------------------*/
+
+typedef struct _ticket_lock_t {
+    unsigned next;
+    unsigned serving;
+} ticket_lock_t;
+
+static inline void ticket_lock(ticket_lock_t* l) {
+    unsigned me = __atomic_fetch_add(&l->next, 1, __ATOMIC_RELAXED);
+    SPIN_UNTIL(__atomic_load_n(&l->serving, __ATOMIC_ACQUIRE) == me);
+}
+
+static inline void ticket_unlock(ticket_lock_t* l) {
+    __atomic_store_n(&l->serving, l->serving + 1, __ATOMIC_RELEASE);
+}
+
+/* only meaningful while holding the lock: does anybody wait for it? */
+static inline int ticket_has_waiters(ticket_lock_t* l) {
+    return __atomic_load_n(&l->next, __ATOMIC_RELAXED) - l->serving > 1;
+}
+
+/*---------------------------- MCS queue lock ----------------------------*/
+
+/* every waiter spins on its own node, the lock word only holds the tail of the queue */
+typedef struct _mcs_node_t {
+    struct _mcs_node_t* next;
+    int locked;
+} __attribute__((aligned(CACHE_LINE))) mcs_node_t;
+
+typedef struct _mcs_lock_t {
+    mcs_node_t* tail;
+} mcs_lock_t;
+
+static inline void mcs_lock(mcs_lock_t* l, mcs_node_t* me) {
+    me->next = NULL;
+    me->locked = 1;
+    mcs_node_t* prev = __atomic_exchange_n(&l->tail, me, __ATOMIC_ACQ_REL);
+    if (prev) {
+        __atomic_store_n(&prev->next, me, __ATOMIC_RELEASE);
+        SPIN_UNTIL(!__atomic_load_n(&me->locked, __ATOMIC_ACQUIRE));
+    }
+}
+
+static inline void mcs_unlock(mcs_lock_t* l, mcs_node_t* me) {
+    mcs_node_t* next = __atomic_load_n(&me->next, __ATOMIC_ACQUIRE);
+    if (!next) {
+        mcs_node_t* expected = me;
+        if (__atomic_compare_exchange_n(&l->tail, &expected, NULL, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return;
+        }
+        // a waiter swapped itself in but has not linked itself yet
+        SPIN_UNTIL((next = __atomic_load_n(&me->next, __ATOMIC_ACQUIRE)));
+    }
+    __atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+}
+
+/*---------------------------- CLH queue lock ----------------------------*/
+
+/*
+ * Every waiter spins on the node of its predecessor. Releasing the lock
+ * hands the thread's node to the successor and the thread keeps its
+ * predecessor's node for the next acquisition, so nodes migrate between
+ * threads and must be heap allocated.
+ */
+typedef struct _clh_node_t {
+    int locked;
+} __attribute__((aligned(CACHE_LINE))) clh_node_t;
+
+typedef struct _clh_lock_t {
+    clh_node_t* tail;
+} clh_lock_t;
+
+/* one per thread and lock */
+typedef struct _clh_handle_t {
+    clh_node_t* node;
+    clh_node_t* pred;
+} clh_handle_t;
+
+static inline clh_node_t* clh_node_alloc() {
+    clh_node_t* node = (clh_node_t*)aligned_alloc(CACHE_LINE, sizeof(clh_node_t));
+    assert(node);
+    node->locked = 0;
+    return node;
+}
+
+static inline void clh_init(clh_lock_t* l) {
+    l->tail = clh_node_alloc();
+}
+
+/* the nodes of the handles and the tail are distinct once nobody holds the lock */
+static inline void clh_destroy(clh_lock_t* l) {
+    free(l->tail);
+}
+
+static inline void clh_handle_init(clh_handle_t* h) {
+    h->node = clh_node_alloc();
+    h->pred = NULL;
+}
+
+static inline void clh_handle_destroy(clh_handle_t* h) {
+    free(h->node);
+}
+
+static inline void clh_lock(clh_lock_t* l, clh_handle_t* h) {
+    h->node->locked = 1;
+    h->pred = __atomic_exchange_n(&l->tail, h->node, __ATOMIC_ACQ_REL);
+    SPIN_UNTIL(!__atomic_load_n(&h->pred->locked, __ATOMIC_ACQUIRE));
+}
+
+static inline void clh_unlock(clh_lock_t* l, clh_handle_t* h) {
+    clh_node_t* node = h->node;
+    h->node = h->pred;
+    __atomic_store_n(&node->locked, 0, __ATOMIC_RELEASE);
+}
+
+/*---------------------------- NUMA cohort lock ----------------------------*/
+
+/*
+ * Lock cohorting (Dice, Marathe and Shavit): a thread first takes the
+ * lock of its node, then the global lock. On release, if another thread
+ * of the same node waits, the global lock is passed along with the local
+ * one, so the protected data stays in the node's caches. After
+ * `max_passes` local handoffs in a row the global lock is released, so
+ * the other nodes are not starved. The global lock is a ticket lock
+ * because a thread may release it on behalf of another one.
+ */
+typedef struct _cohort_node_t {
+    ticket_lock_t local;
+    int global_held; // the cohort owns the global lock, protected by `local`
+    int passes;      // local handoffs since the global lock was taken
+} __attribute__((aligned(CACHE_LINE))) cohort_node_t;
+
+typedef struct _cohort_lock_t {
+    ticket_lock_t global;
+    cohort_node_t* nodes;
+    int n_nodes;
+    int max_passes;
+} cohort_lock_t;
+
+static inline void cohort_init(cohort_lock_t* l, int n_nodes, int max_passes) {
+    memset(&l->global, 0, sizeof(ticket_lock_t));
+    l->nodes = (cohort_node_t*)aligned_alloc(CACHE_LINE, n_nodes * sizeof(cohort_node_t));
+    assert(l->nodes);
+    memset(l->nodes, 0, n_nodes * sizeof(cohort_node_t));
+    l->n_nodes = n_nodes;
+    l->max_passes = max_passes;
+}
+
+static inline void cohort_destroy(cohort_lock_t* l) {
+    free(l->nodes);
+}
+
+/* `node` is the caller's NUMA node, pass the same one to `cohort_unlock` */
+static inline void cohort_lock(cohort_lock_t* l, int node) {
+    cohort_node_t* c = &l->nodes[node % l->n_nodes];
+    ticket_lock(&c->local);
+    if (!c->global_held) {
+        ticket_lock(&l->global);
+        c->global_held = 1;
+        c->passes = 0;
+    }
+}
+
+static inline void cohort_unlock(cohort_lock_t* l, int node) {
+    cohort_node_t* c = &l->nodes[node % l->n_nodes];
+    if (ticket_has_waiters(&c->local) && c->passes < l->max_passes) {
+        ++c->passes;
+    } else {
+        c->global_held = 0;
+        ticket_unlock(&l->global);
+    }
+    ticket_unlock(&c->local);
+}
+
+#endif /* QLOCK_H */
@@ -0,0 +1,285 @@
+/*
+ * Safe memory reclamation for lock-free structures: a node unlinked by
+ * one thread may still be read by another that loaded the pointer
+ * before the unlink, so it can only be freed once no thread can hold a
+ * reference any more. Two schemes with the same retire interface:
+ *
+ * - epoch-based reclamation (EBR, Fraser): threads announce the global
+ *   epoch while they access the structure; a node retired in epoch e is
+ *   freed once the epoch reached e + 2. Cheap per access, but one
+ *   stalled thread stops all reclamation.
+ * - hazard pointers (Michael): threads publish the pointers they are
+ *   about to dereference; a retired node is freed once no hazard pointer
+ *   names it. A fence per protected load, but the unreclaimed memory is
+ *   bounded even when a thread stalls.
+ *
+ * Every call takes the id of the calling thread, in [0, n_threads).
+ */
+#ifndef RECLAIM_H
+#define RECLAIM_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+#include "util.h"
+
+#ifndef CACHE_LINE
+#define CACHE_LINE 64
+#endif
+
+#define EBR_RETIRE_THRESHOLD 64 // retires between two attempts to advance the epoch
+#define HP_PER_THREAD 2         // hazard pointers per thread
+
+typedef void (*reclaim_free_t)(void* ptr);
+
+/* a retired node and when it was retired, for the reclamation latency */
+typedef struct _retired_t {
+    void* ptr;
+    uint64_t retired_ns;
+} retired_t;
+
+typedef struct _retire_list_t {
+    retired_t* items;
+    size_t n;
+    size_t cap;
+} retire_list_t;
+
+/* per-thread counters, summed by `reclaim_stats_sum` */
+typedef struct _reclaim_stats_t {
+    long retired;
+    long freed;
+    uint64_t latency_sum_ns; // retire to free, over the freed nodes
+    uint64_t latency_max_ns;
+} reclaim_stats_t;
+
+static inline void retire_list_push(retire_list_t* l, void* ptr) {
+    if (l->n == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 64;
+        l->items = (retired_t*)realloc(l->items, l->cap * sizeof(retired_t));
+        assert(l->items);
+    }
+    l->items[l->n].ptr = ptr;
+    l->items[l->n].retired_ns = now_ns();
+    ++l->n;
+}
+
+static inline void reclaim_note_free(reclaim_stats_t* s, const retired_t* r, uint64_t now) {
+    uint64_t latency = now - r->retired_ns;
+    ++s->freed;
+    s->latency_sum_ns += latency;
+    s->latency_max_ns = latency > s->latency_max_ns ? latency : s->latency_max_ns;
+}
+
+/* free every node of `l` */
+static inline void retire_list_free_all(retire_list_t* l, reclaim_free_t free_fn, reclaim_stats_t* s) {
+    uint64_t now = now_ns();
+    for (size_t i = 0; i < l->n; ++i) {
+        free_fn(l->items[i].ptr);
+        reclaim_note_free(s, &l->items[i], now);
+    }
+    l->n = 0;
+}
+
+static inline void reclaim_stats_sum(reclaim_stats_t* sum, const reclaim_stats_t* s) {
+    sum->retired += s->retired;
+    sum->freed += s->freed;
+    sum->latency_sum_ns += s->latency_sum_ns;
+    sum->latency_max_ns = s->latency_max_ns > sum->latency_max_ns ? s->latency_max_ns : sum->latency_max_ns;
+}
+
+/*---------------------------- epoch-based reclamation ----------------------------*/
+
+typedef struct _ebr_thread_t {
+    unsigned long epoch; // the epoch announced by the last `ebr_enter`
+    int active;          // between `ebr_enter` and `ebr_exit`
+    retire_list_t lists[3]; // nodes retired while the global epoch was e go to lists[e % 3]
+    int since_advance;
+    reclaim_stats_t stats;
+} __attribute__((aligned(CACHE_LINE))) ebr_thread_t;
+
+typedef struct _ebr_t {
+    unsigned long epoch __attribute__((aligned(CACHE_LINE)));
+    ebr_thread_t* threads;
+    int n_threads;
+    reclaim_free_t free_fn;
+} ebr_t;
+
+static inline void ebr_init(ebr_t* e, int n_threads, reclaim_free_t free_fn) {
+    e->epoch = 0;
+    e->threads = (ebr_thread_t*)aligned_alloc(CACHE_LINE, n_threads * sizeof(ebr_thread_t));
+    assert(e->threads);
+    memset(e->threads, 0, n_threads * sizeof(ebr_thread_t));
+    e->n_threads = n_threads;
+    e->free_fn = free_fn;
+}
+
+/* free everything still retired, only when no thread is inside */
+static inline void ebr_drain(ebr_t* e) {
+    for (int t = 0; t < e->n_threads; ++t) {
+        for (int i = 0; i < 3; ++i) {
+            retire_list_free_all(&e->threads[t].lists[i], e->free_fn, &e->threads[t].stats);
+        }
+    }
+}
+
+static inline void ebr_destroy(ebr_t* e) {
+    ebr_drain(e);
+    for (int t = 0; t < e->n_threads; ++t) {
+        for (int i = 0; i < 3; ++i) {
+            free(e->threads[t].lists[i].items);
+        }
+    }
+    free(e->threads);
+}
+
+/* advance the global epoch if every active thread announced the current one */
+static inline void ebr_try_advance(ebr_t* e) {
+    unsigned long epoch = __atomic_load_n(&e->epoch, __ATOMIC_SEQ_CST);
+    for (int t = 0; t < e->n_threads; ++t) {
+        ebr_thread_t* th = &e->threads[t];
+        if (__atomic_load_n(&th->active, __ATOMIC_SEQ_CST) &&
+            __atomic_load_n(&th->epoch, __ATOMIC_SEQ_CST) != epoch) {
+            return;
+        }
+    }
+    __atomic_compare_exchange_n(&e->epoch, &epoch, epoch + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+/* start accessing the structure; the thread's nodes from two epochs ago become free */
+static inline void ebr_enter(ebr_t* e, int tid) {
+    ebr_thread_t* th = &e->threads[tid];
+    __atomic_store_n(&th->active, 1, __ATOMIC_SEQ_CST);
+    unsigned long epoch = __atomic_load_n(&e->epoch, __ATOMIC_SEQ_CST);
+    if (th->epoch != epoch) {
+        // lists[(epoch + 1) % 3] holds epoch - 2 and older, nobody can reach those any more
+        retire_list_free_all(&th->lists[(epoch + 1) % 3], e->free_fn, &th->stats);
+        __atomic_store_n(&th->epoch, epoch, __ATOMIC_SEQ_CST);
+    }
+}
+
+static inline void ebr_exit(ebr_t* e, int tid) {
+    __atomic_store_n(&e->threads[tid].active, 0, __ATOMIC_RELEASE);
+}
+
+/*!
+ * \brief `ptr` is unlinked, free it two epochs from now. The node is
+ * stamped with the global epoch read after the unlink, not the thread's
+ * own one, which may lag by one: a thread that entered in the newer
+ * epoch can still have loaded the node before the unlink.
+ */
+static inline void ebr_retire(ebr_t* e, int tid, void* ptr) {
+    ebr_thread_t* th = &e->threads[tid];
+    unsigned long epoch = __atomic_load_n(&e->epoch, __ATOMIC_SEQ_CST);
+    retire_list_push(&th->lists[epoch % 3], ptr);
+    ++th->stats.retired;
+    if (++th->since_advance >= EBR_RETIRE_THRESHOLD) {
+        th->since_advance = 0;
+        ebr_try_advance(e);
+    }
+}
+
+/*---------------------------- hazard pointers ----------------------------*/
+
+typedef struct _hp_thread_t {
+    void* hazards[HP_PER_THREAD];
+    retire_list_t retired;
+    reclaim_stats_t stats;
+} __attribute__((aligned(CACHE_LINE))) hp_thread_t;
+
+typedef struct _hp_t {
+    hp_thread_t* threads;
+    int n_threads;
+    size_t scan_threshold; // retired nodes that trigger a scan, 2 * all hazard pointers
+    reclaim_free_t free_fn;
+} hp_t;
+
+static inline void hp_init(hp_t* h, int n_threads, reclaim_free_t free_fn) {
+    h->threads = (hp_thread_t*)aligned_alloc(CACHE_LINE, n_threads * sizeof(hp_thread_t));
+    assert(h->threads);
+    memset(h->threads, 0, n_threads * sizeof(hp_thread_t));
+    h->n_threads = n_threads;
+    h->scan_threshold = 2 * HP_PER_THREAD * n_threads;
+    h->free_fn = free_fn;
+}
+
+/* free everything still retired, only when no thread is inside */
+static inline void hp_drain(hp_t* h) {
+    for (int t = 0; t < h->n_threads; ++t) {
+        retire_list_free_all(&h->threads[t].retired, h->free_fn, &h->threads[t].stats);
+    }
+}
+
+static inline void hp_destroy(hp_t* h) {
+    hp_drain(h);
+    for (int t = 0; t < h->n_threads; ++t) {
+        free(h->threads[t].retired.items);
+    }
+    free(h->threads);
+}
+
+/* load `*src` into hazard pointer `i` and return it once the publication is known to be in time */
+static inline void* hp_protect(hp_t* h, int tid, int i, void** src) {
+    void* p = __atomic_load_n(src, __ATOMIC_ACQUIRE);
+    for (;;) {
+        __atomic_store_n(&h->threads[tid].hazards[i], p, __ATOMIC_SEQ_CST);
+        void* again = __atomic_load_n(src, __ATOMIC_SEQ_CST);
+        if (again == p) {
+            return p;
+        }
+        p = again;
+    }
+}
+
+static inline void hp_clear(hp_t* h, int tid, int i) {
+    __atomic_store_n(&h->threads[tid].hazards[i], NULL, __ATOMIC_RELEASE);
+}
+
+static inline int hp_cmp_ptr(const void* a, const void* b) {
+    uintptr_t x = *(const uintptr_t*)a, y = *(const uintptr_t*)b;
+    return (x > y) - (x < y);
+}
+
+/* free the thread's retired nodes that no hazard pointer names */
+static inline void hp_scan(hp_t* h, int tid) {
+    int n = h->n_threads * HP_PER_THREAD;
+    void* hazards[n];
+    int n_hazards = 0;
+    for (int t = 0; t < h->n_threads; ++t) {
+        for (int i = 0; i < HP_PER_THREAD; ++i) {
+            void* p = __atomic_load_n(&h->threads[t].hazards[i], __ATOMIC_SEQ_CST);
+            if (p) {
+                hazards[n_hazards++] = p;
+            }
+        }
+    }
+    qsort(hazards, n_hazards, sizeof(void*), hp_cmp_ptr);
+
+    hp_thread_t* th = &h->threads[tid];
+    uint64_t now = now_ns();
+    size_t kept = 0;
+    for (size_t i = 0; i < th->retired.n; ++i) {
+        retired_t* r = &th->retired.items[i];
+        if (bsearch(&r->ptr, hazards, n_hazards, sizeof(void*), hp_cmp_ptr)) {
+            th->retired.items[kept++] = *r;
+        } else {
+            h->free_fn(r->ptr);
+            reclaim_note_free(&th->stats, r, now);
+        }
+    }
+    th->retired.n = kept;
+}
+
+/* `ptr` is unlinked, free it once no hazard pointer names it */
+static inline void hp_retire(hp_t* h, int tid, void* ptr) {
+    hp_thread_t* th = &h->threads[tid];
+    retire_list_push(&th->retired, ptr);
+    ++th->stats.retired;
+    if (th->retired.n >= h->scan_threshold) {
+        hp_scan(h, tid);
+    }
+}
+
+#endif /* RECLAIM_H */
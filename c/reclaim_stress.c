@@ -0,0 +1,252 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+#include <time.h>
+#include <sys/sysinfo.h>
+
+#define CACHE_LINE 64
+#define PREFILL 1024          // nodes on the stack before the threads start
+#define NODE_LIVE 0x11feULL
+#define NODE_DEAD 0xdeadULL
+
+#include "reclaim.h"
+#include "util.h"
+
+typedef enum {
+    RECLAIM_LEAK, // free nothing until the threads are joined, the memory baseline
+    RECLAIM_EBR,
+    RECLAIM_HP,
+    N_RECLAIMS,
+} reclaim_kind_t;
+
+static const char* reclaim_names[N_RECLAIMS] = { "leak", "ebr", "hp" };
+
+/* a Treiber stack node, one cache line */
+typedef struct _node_t {
+    struct _node_t* next;
+    uint64_t magic; // NODE_LIVE until freed, a pop that sees anything else read freed memory
+    long value;
+} __attribute__((aligned(CACHE_LINE))) node_t;
+
+typedef struct _stack_t {
+    node_t* head __attribute__((aligned(CACHE_LINE)));
+} lf_stack_t;
+
+typedef struct _stress_t {
+    reclaim_kind_t kind;
+    lf_stack_t stack;
+    ebr_t ebr;
+    hp_t hp;
+    retire_list_t* leaked; // RECLAIM_LEAK, per thread
+    long ops;             // per thread
+} stress_t;
+
+typedef struct _worker_arg_t {
+    stress_t* stress;
+    int tid;
+} worker_arg_t;
+
+/* nodes allocated and not yet freed, and the most there ever were */
+static long live = 0;
+static long peak = 0;
+
+node_t* node_alloc(long value) {
+    node_t* node = (node_t*)aligned_alloc(CACHE_LINE, sizeof(node_t));
+    assert(node);
+    node->magic = NODE_LIVE;
+    node->value = value;
+
+    long n = __atomic_add_fetch(&live, 1, __ATOMIC_RELAXED);
+    long p = __atomic_load_n(&peak, __ATOMIC_RELAXED);
+    while (n > p && !__atomic_compare_exchange_n(&peak, &p, n, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    return node;
+}
+
+void node_free(void* ptr) {
+    ((node_t*)ptr)->magic = NODE_DEAD;
+    free(ptr);
+    __atomic_sub_fetch(&live, 1, __ATOMIC_RELAXED);
+}
+
+/*---------------------------- Treiber stack ----------------------------*/
+
+void push(lf_stack_t* s, node_t* node) {
+    node_t* head = __atomic_load_n(&s->head, __ATOMIC_RELAXED);
+    do {
+        node->next = head;
+    } while (!__atomic_compare_exchange_n(&s->head, &head, node, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*!
+ * \brief unlink the top node and return it, NULL if the stack is empty.
+ * Reading `head->next` is what needs the reclamation: another thread may
+ * have popped and freed `head` in the meantime.
+ */
+node_t* pop(stress_t* st, int tid) {
+    lf_stack_t* s = &st->stack;
+    node_t* head;
+    for (;;) {
+        if (st->kind == RECLAIM_HP) {
+            head = (node_t*)hp_protect(&st->hp, tid, 0, (void**)&s->head);
+        } else {
+            head = __atomic_load_n(&s->head, __ATOMIC_ACQUIRE);
+        }
+        if (!head) {
+            break;
+        }
+        assert(head->magic == NODE_LIVE);
+        node_t* next = head->next;
+        if (__atomic_compare_exchange_n(&s->head, &head, next, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (st->kind == RECLAIM_HP) {
+        hp_clear(&st->hp, tid, 0);
+    }
+    return head;
+}
+
+void* worker(void* arg) {
+    stress_t* st = ((worker_arg_t*)arg)->stress;
+    const int tid = ((worker_arg_t*)arg)->tid;
+    unsigned int seed = tid + 1;
+
+    for (long i = 0; i < st->ops; ++i) {
+        if (st->kind == RECLAIM_EBR) {
+            ebr_enter(&st->ebr, tid);
+        }
+        if (rand_r(&seed) & 1) {
+            push(&st->stack, node_alloc(i));
+        } else {
+            node_t* node = pop(st, tid);
+            if (node) {
+                switch (st->kind) {
+                case RECLAIM_EBR: ebr_retire(&st->ebr, tid, node); break;
+                case RECLAIM_HP:  hp_retire(&st->hp, tid, node); break;
+                default:          retire_list_push(&st->leaked[tid], node); break;
+                }
+            }
+        }
+        if (st->kind == RECLAIM_EBR) {
+            ebr_exit(&st->ebr, tid);
+        }
+    }
+    return NULL;
+}
+
+/*!
+ * \brief push and pop at random from `n_threads` threads, and report the
+ * ops/sec, the retire-to-free latency and the high-water mark of the
+ * nodes in memory (on the stack plus retired but not yet freed)
+ */
+void run(reclaim_kind_t kind, int n_threads, long ops) {
+    stress_t st;
+    pthread_t threads[n_threads];
+    worker_arg_t args[n_threads];
+
+    st.kind = kind;
+    st.stack.head = NULL;
+    st.ops = ops;
+    ebr_init(&st.ebr, n_threads, node_free);
+    hp_init(&st.hp, n_threads, node_free);
+    st.leaked = (retire_list_t*)calloc(n_threads, sizeof(retire_list_t));
+    assert(st.leaked);
+    live = peak = 0;
+    for (int i = 0; i < PREFILL; ++i) {
+        push(&st.stack, node_alloc(i));
+    }
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < n_threads; ++i) {
+        args[i].stress = &st;
+        args[i].tid = i;
+        assert( pthread_create(&threads[i], NULL, worker, &args[i]) == 0 );
+    }
+    for (int i = 0; i < n_threads; ++i) {
+        assert( pthread_join(threads[i], NULL) == 0 );
+    }
+    uint64_t elapsed = now_ns() - start;
+    long at_end = live;
+
+    reclaim_stats_t stats = { 0 };
+    if (kind == RECLAIM_LEAK) {
+        for (int i = 0; i < n_threads; ++i) {
+            stats.retired += st.leaked[i].n;
+            retire_list_free_all(&st.leaked[i], node_free, &stats);
+        }
+    } else if (kind == RECLAIM_EBR) {
+        ebr_drain(&st.ebr);
+        for (int i = 0; i < n_threads; ++i) {
+            reclaim_stats_sum(&stats, &st.ebr.threads[i].stats);
+        }
+    } else if (kind == RECLAIM_HP) {
+        hp_drain(&st.hp);
+        for (int i = 0; i < n_threads; ++i) {
+            reclaim_stats_sum(&stats, &st.hp.threads[i].stats);
+        }
+    }
+
+    /* every retired node was freed exactly once, only the stack is left */
+    long on_stack = 0;
+    for (node_t* node = st.stack.head; node; node = node->next) {
+        ++on_stack;
+    }
+    assert(stats.freed == stats.retired && live == on_stack);
+
+    printf("[%s] threads=%d: %.2f M ops/s, retired %ld, freed %ld, latency avg %.0f ns max %lu ns, "
+           "peak %ld nodes (%ld KB), %ld at the end\n",
+           reclaim_names[kind], n_threads, ops * n_threads * 1e3 / elapsed, stats.retired, stats.freed,
+           stats.freed ? (double)stats.latency_sum_ns / stats.freed : 0, stats.latency_max_ns,
+           peak, peak * sizeof(node_t) / 1024, at_end);
+
+    while (st.stack.head) {
+        node_t* node = st.stack.head;
+        st.stack.head = node->next;
+        node_free(node);
+    }
+    for (int i = 0; i < n_threads; ++i) {
+        free(st.leaked[i].items);
+    }
+    free(st.leaked);
+    ebr_destroy(&st.ebr);
+    hp_destroy(&st.hp);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 4) {
+        printf("Usage: %s [<ops per thread> [<threads> [<reclaim>]]]\n"
+               "  reclaim: leak, ebr or hp\n"
+               "Without threads, sweep them from 1 to all cores for every reclaim.\n", argv[0]);
+        exit(1);
+    }
+    const long ops = argc >= 2 ? atol(argv[1]) : 1000000;
+    const int n_threads = argc >= 3 ? atoi(argv[2]) : 0;
+    reclaim_kind_t kind = argc == 4 ? find_name(reclaim_names, N_RECLAIMS, argv[3]) : N_RECLAIMS;
+    if (ops < 1 || n_threads < 0 || (argc == 4 && kind == N_RECLAIMS)) {
+        printf("Error: invalid arguments.\n");
+        exit(1);
+    }
+
+    const int nprocs = get_nprocs();
+    for (reclaim_kind_t k = 0; k < N_RECLAIMS; ++k) {
+        if (kind != N_RECLAIMS && k != kind) {
+            continue;
+        }
+        if (n_threads > 0) {
+            run(k, n_threads, ops);
+            continue;
+        }
+        for (int t = 1; ; t = t * 2 < nprocs ? t * 2 : nprocs) {
+            run(k, t, ops);
+            if (t == nprocs) {
+                break;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,302 @@
+/*
+ * Background services: periodic tasks run by a few detached worker
+ * threads, instead of one detached `while (1) { ...; sleep(); }` thread
+ * per task like detach.c. Every worker keeps its tasks in a heap ordered
+ * by deadline and sleeps in poll() on two descriptors: a timerfd armed
+ * for the earliest deadline, and an eventfd that new tasks and the
+ * shutdown write to. Deadlines are rounded up to a grid of `slack_ns`,
+ * so tasks due within the same slack share one wakeup.
+ *
+ * `service_shutdown` is cooperative: it wakes every worker through its
+ * eventfd, each gives its tasks a last call to drain, releases its
+ * resources and reports back; nobody joins the detached workers.
+ */
+#ifndef SERVICE_H
+#define SERVICE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+
+#include "util.h"
+
+#ifndef CACHE_LINE
+#define CACHE_LINE 64
+#endif
+
+/*!
+ * \brief a periodic task: called with `stopping` 0 every period, and once
+ * with `stopping` 1 at a draining shutdown.
+ *
+ * \return 0 to keep the task, anything else to drop it
+ */
+typedef int (*service_fn_t)(void* arg, int stopping);
+
+typedef struct _service_task_t {
+    uint64_t deadline_ns;            // CLOCK_MONOTONIC
+    uint64_t period_ns;
+    service_fn_t fn;
+    void* arg;
+    struct _service_task_t* next;    // in the inbox
+} service_task_t;
+
+typedef struct _service_worker_t {
+    int timer_fd;
+    int event_fd;
+    service_task_t** heap;           // min-heap on the deadline, only the worker touches it
+    int n_tasks;
+    int cap_tasks;
+    uint64_t armed_ns;               // the deadline the timerfd is armed for, 0 for none
+    pthread_mutex_t lock;            // the inbox
+    service_task_t* inbox;           // added but not yet in the heap
+    long wakeups;
+    long calls;
+    struct _service_t* svc;
+} __attribute__((aligned(CACHE_LINE))) service_worker_t;
+
+typedef struct _service_t {
+    service_worker_t* workers;
+    int n_workers;
+    unsigned next_worker;            // round robin of `service_add`
+    uint64_t slack_ns;
+    int stopping;
+    int drain;
+    pthread_mutex_t lock;            // `live` and the totals
+    pthread_cond_t exited;
+    int live;                        // workers not yet gone
+    long wakeups;                    // totals of the gone workers
+    long calls;
+} service_t;
+
+/*---------------------------- deadline heap ----------------------------*/
+
+static inline void service_heap_swap(service_worker_t* w, int i, int j) {
+    service_task_t* t = w->heap[i];
+    w->heap[i] = w->heap[j];
+    w->heap[j] = t;
+}
+
+static inline void service_heap_push(service_worker_t* w, service_task_t* t) {
+    if (w->n_tasks == w->cap_tasks) {
+        w->cap_tasks = w->cap_tasks ? w->cap_tasks * 2 : 64;
+        w->heap = (service_task_t**)realloc(w->heap, w->cap_tasks * sizeof(service_task_t*));
+        assert(w->heap);
+    }
+    int i = w->n_tasks++;
+    w->heap[i] = t;
+    while (i > 0 && w->heap[(i - 1) / 2]->deadline_ns > w->heap[i]->deadline_ns) {
+        service_heap_swap(w, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static inline service_task_t* service_heap_pop(service_worker_t* w) {
+    service_task_t* top = w->heap[0];
+    w->heap[0] = w->heap[--w->n_tasks];
+    for (int i = 0; ; ) {
+        int l = 2 * i + 1, r = l + 1, m = i;
+        if (l < w->n_tasks && w->heap[l]->deadline_ns < w->heap[m]->deadline_ns) {
+            m = l;
+        }
+        if (r < w->n_tasks && w->heap[r]->deadline_ns < w->heap[m]->deadline_ns) {
+            m = r;
+        }
+        if (m == i) {
+            break;
+        }
+        service_heap_swap(w, i, m);
+        i = m;
+    }
+    return top;
+}
+
+/*---------------------------- workers ----------------------------*/
+
+/* `ns` rounded up to the slack grid */
+static inline uint64_t service_round(const service_t* svc, uint64_t ns) {
+    return (ns + svc->slack_ns - 1) / svc->slack_ns * svc->slack_ns;
+}
+
+/* arm the timerfd for the earliest deadline, or disarm it */
+static inline void service_arm(service_worker_t* w) {
+    uint64_t deadline = w->n_tasks ? w->heap[0]->deadline_ns : 0;
+    if (deadline == w->armed_ns) {
+        return;
+    }
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = deadline / 1000000000ull;
+    its.it_value.tv_nsec = deadline % 1000000000ull;
+    assert( timerfd_settime(w->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) == 0 );
+    w->armed_ns = deadline;
+}
+
+/* run the due tasks and put them back one period later; a late task skips the periods it missed */
+static inline void service_run_due(service_worker_t* w) {
+    uint64_t now = now_ns();
+    while (w->n_tasks && w->heap[0]->deadline_ns <= now) {
+        service_task_t* t = service_heap_pop(w);
+        ++w->calls;
+        if (t->fn(t->arg, 0)) {
+            free(t);
+            continue;
+        }
+        t->deadline_ns += t->period_ns;
+        if (t->deadline_ns <= now) {
+            t->deadline_ns = now + t->period_ns;
+        }
+        t->deadline_ns = service_round(w->svc, t->deadline_ns);
+        service_heap_push(w, t);
+    }
+}
+
+static void* service_worker_loop(void* arg) {
+    service_worker_t* w = (service_worker_t*)arg;
+    service_t* svc = w->svc;
+    struct pollfd fds[2] = { { w->timer_fd, POLLIN, 0 }, { w->event_fd, POLLIN, 0 } };
+    uint64_t buf;
+
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            continue; // EINTR
+        }
+        ++w->wakeups;
+        if (fds[0].revents & POLLIN) {
+            if (read(w->timer_fd, &buf, sizeof(buf)) < 0) {
+                // spurious, the timer was re-armed meanwhile
+            }
+            w->armed_ns = 0; // fired, a one-shot timer is disarmed now
+        }
+        if (fds[1].revents & POLLIN) {
+            if (read(w->event_fd, &buf, sizeof(buf)) < 0) {
+                // nothing pending, another wakeup read it
+            }
+        }
+        pthread_mutex_lock(&w->lock);
+        service_task_t* t = w->inbox;
+        w->inbox = NULL;
+        pthread_mutex_unlock(&w->lock);
+        while (t) {
+            service_task_t* next = t->next;
+            service_heap_push(w, t);
+            t = next;
+        }
+        if (__atomic_load_n(&svc->stopping, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        service_run_due(w);
+        service_arm(w);
+    }
+
+    /* drain: a last call for every task, then give everything back */
+    const int drain = svc->drain;
+    for (int i = 0; i < w->n_tasks; ++i) {
+        if (drain) {
+            ++w->calls;
+            w->heap[i]->fn(w->heap[i]->arg, 1);
+        }
+        free(w->heap[i]);
+    }
+    free(w->heap);
+    close(w->timer_fd);
+    close(w->event_fd);
+    pthread_mutex_destroy(&w->lock);
+
+    // `svc` may be gone once `live` is 0, nothing touches it afterwards
+    pthread_mutex_lock(&svc->lock);
+    svc->wakeups += w->wakeups;
+    svc->calls += w->calls;
+    if (--svc->live == 0) {
+        pthread_cond_broadcast(&svc->exited);
+    }
+    pthread_mutex_unlock(&svc->lock);
+    return NULL;
+}
+
+static inline void service_kick(service_worker_t* w) {
+    uint64_t one = 1;
+    if (write(w->event_fd, &one, sizeof(one)) < 0) {
+        // the counter is saturated, the worker is awake anyway
+    }
+}
+
+/*!
+ * \brief start `n_workers` detached workers; task deadlines are rounded
+ * up to multiples of `slack_ns` (at least 1)
+ */
+static inline void service_init(service_t* svc, int n_workers, uint64_t slack_ns) {
+    svc->workers = (service_worker_t*)aligned_alloc(CACHE_LINE, n_workers * sizeof(service_worker_t));
+    assert(svc->workers);
+    memset(svc->workers, 0, n_workers * sizeof(service_worker_t));
+    svc->n_workers = n_workers;
+    svc->next_worker = 0;
+    svc->slack_ns = slack_ns ? slack_ns : 1;
+    svc->stopping = svc->drain = 0;
+    pthread_mutex_init(&svc->lock, NULL);
+    pthread_cond_init(&svc->exited, NULL);
+    svc->live = n_workers;
+    svc->wakeups = svc->calls = 0;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    assert( pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) == 0 );
+    for (int i = 0; i < n_workers; ++i) {
+        service_worker_t* w = &svc->workers[i];
+        w->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        w->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        assert(w->timer_fd >= 0 && w->event_fd >= 0);
+        pthread_mutex_init(&w->lock, NULL);
+        w->svc = svc;
+        pthread_t t;
+        assert( pthread_create(&t, &attr, service_worker_loop, w) == 0 );
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/* run `fn(arg, 0)` every `period_ns`, the first time one period from now */
+static inline void service_add(service_t* svc, uint64_t period_ns, service_fn_t fn, void* arg) {
+    service_task_t* t = (service_task_t*)malloc(sizeof(service_task_t));
+    assert(t);
+    t->period_ns = period_ns;
+    t->deadline_ns = service_round(svc, now_ns() + period_ns);
+    t->fn = fn;
+    t->arg = arg;
+
+    unsigned i = __atomic_fetch_add(&svc->next_worker, 1, __ATOMIC_RELAXED) % svc->n_workers;
+    service_worker_t* w = &svc->workers[i];
+    pthread_mutex_lock(&w->lock);
+    t->next = w->inbox;
+    w->inbox = t;
+    pthread_mutex_unlock(&w->lock);
+    service_kick(w);
+}
+
+/*!
+ * \brief stop every worker and wait until they are gone; with `drain`,
+ * every task gets a last call with `stopping` 1 first. The totals of
+ * wakeups and calls stay in `svc`.
+ */
+static inline void service_shutdown(service_t* svc, int drain) {
+    svc->drain = drain;
+    __atomic_store_n(&svc->stopping, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < svc->n_workers; ++i) {
+        service_kick(&svc->workers[i]);
+    }
+    pthread_mutex_lock(&svc->lock);
+    while (svc->live > 0) {
+        pthread_cond_wait(&svc->exited, &svc->lock);
+    }
+    pthread_mutex_unlock(&svc->lock);
+    pthread_cond_destroy(&svc->exited);
+    pthread_mutex_destroy(&svc->lock);
+    free(svc->workers);
+}
+
+#endif /* SERVICE_H */
@@ -0,0 +1,217 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <assert.h>
+#include <time.h>
+
+#include "combining.h"
+#include "util.h"
+
+#define CACHE_LINE 64
+#define STALENESS_NS 1000000 // approximate reads may be up to 1 ms old
+
+/*---------------------------- sharded counter ----------------------------*/
+
+/* one slot per thread, each on its own cache line */
+typedef struct _counter_slot_t {
+    long value;
+} __attribute__((aligned(CACHE_LINE))) counter_slot_t;
+
+typedef struct _sharded_counter_t {
+    counter_slot_t* slots;
+    int n_slots;
+    long staleness_ns;       // bound on the age of an approximate read
+    long cached;             // the last sum, for approximate reads
+    uint64_t cached_at_ns;
+    pthread_mutex_t refresh; // only one reader refreshes the cache at a time
+} sharded_counter_t;
+
+void sharded_counter_init(sharded_counter_t* c, int n_slots, long staleness_ns) {
+    c->slots = (counter_slot_t*)aligned_alloc(CACHE_LINE, n_slots * sizeof(counter_slot_t));
+    assert(c->slots);
+    for (int i = 0; i < n_slots; ++i) {
+        c->slots[i].value = 0;
+    }
+    c->n_slots = n_slots;
+    c->staleness_ns = staleness_ns;
+    c->cached = 0;
+    c->cached_at_ns = 0;
+    pthread_mutex_init(&c->refresh, NULL);
+}
+
+void sharded_counter_destroy(sharded_counter_t* c) {
+    pthread_mutex_destroy(&c->refresh);
+    free(c->slots);
+}
+
+/* each slot has a single writer, so no read-modify-write instruction is needed */
+static inline void sharded_counter_add(sharded_counter_t* c, int slot, long delta) {
+    counter_slot_t* s = &c->slots[slot];
+    __atomic_store_n(&s->value, __atomic_load_n(&s->value, __ATOMIC_RELAXED) + delta, __ATOMIC_RELAXED);
+}
+
+/*!
+ * \brief sum every slot. The result lies between the counter values at
+ * the start and at the end of the read, and is exact once the writers
+ * have stopped.
+ */
+long sharded_counter_read(sharded_counter_t* c) {
+    long sum = 0;
+    for (int i = 0; i < c->n_slots; ++i) {
+        sum += __atomic_load_n(&c->slots[i].value, __ATOMIC_RELAXED);
+    }
+    return sum;
+}
+
+/*!
+ * \brief return the cached sum if it is at most `staleness_ns` old, and
+ * refresh it otherwise. Most reads touch one cache line instead of all
+ * the slots. A reader that finds another one refreshing sums the slots
+ * itself rather than wait or return the stale cache.
+ */
+long sharded_counter_read_approx(sharded_counter_t* c) {
+    uint64_t now = now_ns();
+    if (now - __atomic_load_n(&c->cached_at_ns, __ATOMIC_ACQUIRE) <= c->staleness_ns) {
+        return __atomic_load_n(&c->cached, __ATOMIC_RELAXED);
+    }
+    if (pthread_mutex_trylock(&c->refresh) != 0) {
+        return sharded_counter_read(c);
+    }
+    long sum = sharded_counter_read(c);
+    __atomic_store_n(&c->cached, sum, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->cached_at_ns, now, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&c->refresh);
+    return sum;
+}
+
+/*---------------------------- benchmark ----------------------------*/
+
+typedef enum {
+    COUNTER_MUTEX,          // `entry_point_slow` of shared_data_mutex.c
+    COUNTER_ATOMIC,         // one word, atomic fetch_add
+    COUNTER_SHARDED,        // sharded counter, exact reads
+    COUNTER_SHARDED_APPROX, // sharded counter, reads at most STALENESS_NS old
+    COUNTER_COMBINING,      // one word, increments applied in batches by a flat combiner
+    N_COUNTERS,
+} counter_kind_t;
+
+static const char* counter_names[N_COUNTERS] = { "mutex", "atomic", "sharded", "sharded-approx", "combining" };
+
+static counter_kind_t kind;
+static long iterations;
+static volatile int stop_reader;
+
+static long counter = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static sharded_counter_t sharded;
+static fc_t combiner;
+
+/* the combiner is the only writer of `counter` */
+void apply_add(void* ctx, void* op) {
+    __atomic_store_n(&counter, counter + *(long*)op, __ATOMIC_RELAXED);
+}
+
+void* writer(void* arg) {
+    int slot = (int)(intptr_t)arg;
+    for (long i = 0; i < iterations; ++i) {
+        switch (kind) {
+        case COUNTER_MUTEX:
+            pthread_mutex_lock(&lock);
+            counter += 1;
+            pthread_mutex_unlock(&lock);
+            break;
+        case COUNTER_ATOMIC:
+            __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED);
+            break;
+        case COUNTER_COMBINING: {
+            long delta = 1;
+            fc_execute(&combiner, slot, &delta);
+            break;
+        }
+        default:
+            sharded_counter_add(&sharded, slot, 1);
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* reads the counter until the writers are done, returns the number of reads */
+void* reader(void* arg) {
+    long reads = 0;
+    volatile long value;
+    while (!stop_reader) {
+        switch (kind) {
+        case COUNTER_MUTEX:
+            pthread_mutex_lock(&lock);
+            value = counter;
+            pthread_mutex_unlock(&lock);
+            break;
+        case COUNTER_ATOMIC:
+        case COUNTER_COMBINING:
+            value = __atomic_load_n(&counter, __ATOMIC_RELAXED);
+            break;
+        case COUNTER_SHARDED:
+            value = sharded_counter_read(&sharded);
+            break;
+        default:
+            value = sharded_counter_read_approx(&sharded);
+            break;
+        }
+        (void)value;
+        ++reads;
+    }
+    return (void*)(intptr_t)reads;
+}
+
+void run(counter_kind_t k, int n_threads) {
+    pthread_t writers[n_threads], r;
+    void* reads;
+
+    kind = k;
+    counter = 0;
+    stop_reader = 0;
+    sharded_counter_init(&sharded, n_threads, STALENESS_NS);
+    fc_init(&combiner, n_threads, apply_add, NULL);
+
+    uint64_t start = now_ns();
+    assert( pthread_create(&r, NULL, reader, NULL) == 0 );
+    for (int i = 0; i < n_threads; ++i) {
+        assert( pthread_create(&writers[i], NULL, writer, (void*)(intptr_t)i) == 0 );
+    }
+    for (int i = 0; i < n_threads; ++i) {
+        assert( pthread_join(writers[i], NULL) == 0 );
+    }
+    uint64_t elapsed = now_ns() - start;
+    stop_reader = 1;
+    assert( pthread_join(r, &reads) == 0 );
+
+    long total = k == COUNTER_SHARDED || k == COUNTER_SHARDED_APPROX ? sharded_counter_read(&sharded) : counter;
+    assert(total == iterations * n_threads);
+    printf("[%s] threads=%d: %.1f M increments/s, %.1f M reads/s\n", counter_names[k], n_threads,
+           iterations * n_threads * 1e3 / elapsed, (intptr_t)reads * 1e3 / elapsed);
+    if (k == COUNTER_COMBINING) {
+        printf("\t%.2f increments per combining pass\n", (double)combiner.combined / combiner.passes);
+    }
+
+    sharded_counter_destroy(&sharded);
+    fc_destroy(&combiner);
+}
+
+int main(int argc, char* argv[]) {
+    iterations = argc >= 2 ? atol(argv[1]) : 1000000;
+    const int max_threads = argc >= 3 ? atoi(argv[2]) : 128;
+    if (argc > 3 || iterations < 1 || max_threads < 1) {
+        printf("Usage: %s [<increments per thread> [<max threads>]]\n", argv[0]);
+        exit(1);
+    }
+
+    for (int n = 1; n <= max_threads; n *= 2) {
+        for (counter_kind_t k = 0; k < N_COUNTERS; ++k) {
+            run(k, n);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,154 @@
+/*
+ * Thread spawning with explicit stacks. By default every thread gets an
+ * 8 MB stack (ulimit -s) in its own mapping plus a guard page mapping,
+ * which bounds the thread count by vm.max_map_count and costs a page
+ * table walk per stack. `spawn` takes an explicit stack and guard size,
+ * or carves the stack out of a preallocated arena (one mapping for all
+ * stacks, optionally huge pages) and hands it back on `spawn_join` for
+ * the next thread.
+ */
+#ifndef SPAWN_H
+#define SPAWN_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <assert.h>
+#include <sys/mman.h>
+
+#define SPAWN_DEFAULT_GUARD ((size_t)-1) // keep the guard page of the default attributes
+
+typedef struct _stack_arena_t {
+    char* base;
+    size_t map_len;
+    size_t stack_size;
+    int n_stacks;
+    int* free_stacks;   // indices of the stacks nobody runs on
+    int n_free;
+    pthread_mutex_t lock;
+} stack_arena_t;
+
+/*!
+ * \brief map `n_stacks` stacks of `stack_size` bytes at once. With
+ * `huge`, try 2 MB hugetlbfs pages and fall back to transparent huge
+ * pages; a huge page then backs several stacks, which saves TLB entries
+ * but rounds the resident memory up to 2 MB. The stacks have no guard
+ * pages, which would split the mapping again.
+ *
+ * \return 0, or -1 if the memory cannot be mapped
+ */
+static inline int stack_arena_init(stack_arena_t* a, int n_stacks, size_t stack_size, int huge) {
+    const size_t page = huge ? (2UL << 20) : 4096;
+    a->stack_size = (stack_size + 4095) / 4096 * 4096;
+    a->map_len = (a->stack_size * n_stacks + page - 1) / page * page;
+
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK;
+    void* m = MAP_FAILED;
+    if (huge) {
+        // reserved up front: with MAP_NORESERVE a short hugetlbfs pool is a SIGBUS on first touch
+        m = mmap(NULL, a->map_len, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+    }
+    if (m == MAP_FAILED) {
+        m = mmap(NULL, a->map_len, PROT_READ | PROT_WRITE, flags | MAP_NORESERVE, -1, 0);
+        if (m == MAP_FAILED) {
+            return -1;
+        }
+        if (huge) {
+            madvise(m, a->map_len, MADV_HUGEPAGE);
+        }
+    }
+    a->base = (char*)m;
+    a->n_stacks = n_stacks;
+    a->free_stacks = (int*)malloc(n_stacks * sizeof(int));
+    assert(a->free_stacks);
+    // hand out the lowest addresses first
+    for (int i = 0; i < n_stacks; ++i) {
+        a->free_stacks[i] = n_stacks - 1 - i;
+    }
+    a->n_free = n_stacks;
+    pthread_mutex_init(&a->lock, NULL);
+    return 0;
+}
+
+/* only once every thread of the arena is joined */
+static inline void stack_arena_destroy(stack_arena_t* a) {
+    munmap(a->base, a->map_len);
+    free(a->free_stacks);
+    pthread_mutex_destroy(&a->lock);
+}
+
+/* a free stack, NULL if all are in use */
+static inline void* stack_arena_get(stack_arena_t* a) {
+    void* stack = NULL;
+    pthread_mutex_lock(&a->lock);
+    if (a->n_free > 0) {
+        stack = a->base + a->free_stacks[--a->n_free] * a->stack_size;
+    }
+    pthread_mutex_unlock(&a->lock);
+    return stack;
+}
+
+static inline void stack_arena_put(stack_arena_t* a, void* stack) {
+    pthread_mutex_lock(&a->lock);
+    a->free_stacks[a->n_free++] = (int)(((char*)stack - a->base) / a->stack_size);
+    pthread_mutex_unlock(&a->lock);
+}
+
+typedef struct _spawn_opts_t {
+    size_t stack_size;    // 0: the default; ignored with an arena
+    size_t guard_size;    // SPAWN_DEFAULT_GUARD or a size, 0 for none; ignored with an arena
+    stack_arena_t* arena; // NULL: glibc allocates the stack
+} spawn_opts_t;
+
+typedef struct _spawned_t {
+    pthread_t thread;
+    void* stack;          // from `arena`, given back by `spawn_join`
+    stack_arena_t* arena;
+} spawned_t;
+
+/*!
+ * \brief `pthread_create` with the stack `opts` asks for
+ *
+ * \return 0 or the error of `pthread_create`, EAGAIN when the arena has
+ * no free stack
+ */
+static inline int spawn(spawned_t* t, const spawn_opts_t* opts, void* (*fn)(void*), void* arg) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    t->arena = opts->arena;
+    t->stack = NULL;
+    if (opts->arena) {
+        t->stack = stack_arena_get(opts->arena);
+        if (!t->stack) {
+            pthread_attr_destroy(&attr);
+            return EAGAIN;
+        }
+        pthread_attr_setstack(&attr, t->stack, opts->arena->stack_size);
+    } else {
+        if (opts->stack_size) {
+            pthread_attr_setstacksize(&attr, opts->stack_size);
+        }
+        if (opts->guard_size != SPAWN_DEFAULT_GUARD) {
+            pthread_attr_setguardsize(&attr, opts->guard_size);
+        }
+    }
+    int rc = pthread_create(&t->thread, &attr, fn, arg);
+    pthread_attr_destroy(&attr);
+    if (rc != 0 && t->stack) {
+        stack_arena_put(t->arena, t->stack);
+    }
+    return rc;
+}
+
+/* `pthread_join`, then the stack is free for the next `spawn`: nothing runs on it any more */
+static inline int spawn_join(spawned_t* t, void** ret) {
+    int rc = pthread_join(t->thread, ret);
+    if (rc == 0 && t->stack) {
+        stack_arena_put(t->arena, t->stack);
+        t->stack = NULL;
+    }
+    return rc;
+}
+
+#endif /* SPAWN_H */
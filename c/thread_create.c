@@ -0,0 +1,327 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/sysinfo.h>
+
+#define SMALL_STACK (64 * 1024)
+#define ROUND_TRIPS 10000
+#define MAX_BURST 10000
+#define MANY_THREADS 100000
+#define REUSE_STACKS 1024 // the arena of SPAWN_REUSE, far fewer stacks than threads
+
+#include "spawn.h"
+#include "util.h"
+
+typedef enum {
+    ATTR_DEFAULT,  // NULL attributes: 8 MB stack (ulimit -s) and a guard page
+    ATTR_SMALL,    // SMALL_STACK stack
+    ATTR_NO_GUARD, // default stack without the guard page
+    ATTR_AFFINITY, // created on cpu i % nprocs instead of migrating after the start
+    ATTR_DETACHED, // nobody joins, the thread tells it is done through `finished`
+    N_ATTRS,
+} attr_kind_t;
+
+static const char* attr_names[N_ATTRS] = { "default", "small-stack", "no-guard", "affinity", "detached" };
+
+static long finished = 0;
+
+void* entry_point(void* arg) {
+    return NULL;
+}
+
+void* detached_entry_point(void* arg) {
+    __atomic_fetch_add(&finished, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/* the attributes of thread number `i` of kind `kind`, NULL for the defaults */
+pthread_attr_t* make_attr(pthread_attr_t* attr, attr_kind_t kind, int i) {
+    if (kind == ATTR_DEFAULT) {
+        return NULL;
+    }
+    pthread_attr_init(attr);
+    switch (kind) {
+    case ATTR_SMALL:
+        assert( pthread_attr_setstacksize(attr, SMALL_STACK) == 0 );
+        break;
+    case ATTR_NO_GUARD:
+        assert( pthread_attr_setguardsize(attr, 0) == 0 );
+        break;
+    case ATTR_AFFINITY: {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(i % get_nprocs(), &cpus);
+        assert( pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &cpus) == 0 );
+        break;
+    }
+    case ATTR_DETACHED:
+        assert( pthread_attr_setdetachstate(attr, PTHREAD_CREATE_DETACHED) == 0 );
+        break;
+    default:
+        break;
+    }
+    return attr;
+}
+
+/* wait until `n` detached threads ran to their end */
+void wait_detached(long n) {
+    while (__atomic_load_n(&finished, __ATOMIC_ACQUIRE) < n) {
+        sched_yield();
+    }
+}
+
+void print_percentiles(const char* what, uint64_t* ns, size_t n) {
+    qsort(ns, n, sizeof(uint64_t), cmp_u64);
+    printf("%s p50 %lu ns, p90 %lu ns, p99 %lu ns, max %lu ns", what,
+           ns[n / 2], ns[n * 9 / 10], ns[n * 99 / 100], ns[n - 1]);
+}
+
+/*!
+ * \brief create and join (or wait for) one thread at a time, `n` times;
+ * the time of each round trip is from `pthread_create` to the thread
+ * being gone
+ */
+void round_trips(attr_kind_t kind, int n) {
+    uint64_t* ns = (uint64_t*)malloc(n * sizeof(uint64_t));
+    assert(ns);
+    pthread_attr_t attr;
+    finished = 0;
+
+    for (int i = 0; i < n; ++i) {
+        pthread_attr_t* a = make_attr(&attr, kind, i);
+        pthread_t t;
+        uint64_t start = now_ns();
+        assert( pthread_create(&t, a, kind == ATTR_DETACHED ? detached_entry_point : entry_point, NULL) == 0 );
+        if (kind == ATTR_DETACHED) {
+            wait_detached(i + 1);
+        } else {
+            assert( pthread_join(t, NULL) == 0 );
+        }
+        ns[i] = now_ns() - start;
+        if (a) {
+            pthread_attr_destroy(a);
+        }
+    }
+
+    printf("[%s] round trip x%d:", attr_names[kind], n);
+    print_percentiles("", ns, n);
+    printf("\n");
+    free(ns);
+}
+
+/*!
+ * \brief create `n` threads back to back, then join them all; report
+ * the latency of each `pthread_create` and the threads/sec of the
+ * whole burst. Stops early if the system runs out of threads or memory.
+ */
+void burst(attr_kind_t kind, int n) {
+    pthread_t* threads = (pthread_t*)malloc(n * sizeof(pthread_t));
+    uint64_t* ns = (uint64_t*)malloc(n * sizeof(uint64_t));
+    assert(threads && ns);
+    pthread_attr_t attr;
+    finished = 0;
+
+    int created = 0;
+    uint64_t start = now_ns();
+    for (; created < n; ++created) {
+        pthread_attr_t* a = make_attr(&attr, kind, created);
+        uint64_t t0 = now_ns();
+        int rc = pthread_create(&threads[created], a, kind == ATTR_DETACHED ? detached_entry_point : entry_point, NULL);
+        ns[created] = now_ns() - t0;
+        if (a) {
+            pthread_attr_destroy(a);
+        }
+        if (rc != 0) {
+            fprintf(stderr, "[%s] burst of %d: pthread_create failed after %d threads: %s\n",
+                    attr_names[kind], n, created, strerror(rc));
+            break;
+        }
+    }
+    if (kind == ATTR_DETACHED) {
+        wait_detached(created);
+    } else {
+        for (int i = 0; i < created; ++i) {
+            assert( pthread_join(threads[i], NULL) == 0 );
+        }
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    if (created > 0) {
+        printf("[%s] burst of %d: %.0f threads/s,", attr_names[kind], created, created * 1e9 / elapsed);
+        print_percentiles(" create", ns, created);
+        printf("\n");
+    }
+    free(threads);
+    free(ns);
+}
+
+/*---------------------------- many threads ----------------------------*/
+
+typedef enum {
+    SPAWN_DEFAULT,    // glibc stacks of the default size, with guard pages
+    SPAWN_SMALL,      // glibc stacks of SMALL_STACK, with guard pages
+    SPAWN_ARENA,      // SMALL_STACK stacks in one preallocated mapping
+    SPAWN_ARENA_HUGE, // the same on huge pages
+    SPAWN_REUSE,      // REUSE_STACKS arena stacks, recycled as threads are joined
+    N_SPAWNS,
+} spawn_kind_t;
+
+static const char* spawn_names[N_SPAWNS] = { "default", "small-stack", "arena", "arena-huge", "arena-reuse" };
+
+/* the threads of `many` stay alive until the gate opens, so their stacks add up */
+static pthread_mutex_t gate_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gate_cond = PTHREAD_COND_INITIALIZER;
+static int gate_open = 0;
+
+void* gated_entry_point(void* arg) {
+    pthread_mutex_lock(&gate_lock);
+    while (!gate_open) {
+        pthread_cond_wait(&gate_cond, &gate_lock);
+    }
+    pthread_mutex_unlock(&gate_lock);
+    return NULL;
+}
+
+void set_gate(int open) {
+    pthread_mutex_lock(&gate_lock);
+    gate_open = open;
+    pthread_cond_broadcast(&gate_cond);
+    pthread_mutex_unlock(&gate_lock);
+}
+
+typedef struct _footprint_t {
+    long virtual_kb;
+    long resident_kb;
+    long mappings;
+} footprint_t;
+
+footprint_t footprint() {
+    footprint_t fp = { 0, 0, 0 };
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f) {
+        // statm counts pages, 4 KB on x86 but 16 or 64 KB on some arm64 kernels
+        const long page_kb = sysconf(_SC_PAGESIZE) / 1024;
+        if (fscanf(f, "%ld %ld", &fp.virtual_kb, &fp.resident_kb) == 2) {
+            fp.virtual_kb *= page_kb;
+            fp.resident_kb *= page_kb;
+        }
+        fclose(f);
+    }
+    f = fopen("/proc/self/maps", "r");
+    if (f) {
+        int c;
+        while ((c = fgetc(f)) != EOF) {
+            fp.mappings += c == '\n';
+        }
+        fclose(f);
+    }
+    return fp;
+}
+
+/*!
+ * \brief spawn `n` threads that all stay alive (SPAWN_REUSE: at most
+ * REUSE_STACKS at a time), and report the creation rate and the
+ * virtual memory, resident memory and mappings they added
+ */
+void many(spawn_kind_t kind, int n) {
+    spawned_t* threads = (spawned_t*)malloc(n * sizeof(spawned_t));
+    assert(threads);
+    footprint_t before = footprint(), after; // the arena mapping counts too
+    stack_arena_t arena;
+    spawn_opts_t opts = { kind == SPAWN_DEFAULT ? 0 : SMALL_STACK, SPAWN_DEFAULT_GUARD, NULL };
+    if (kind >= SPAWN_ARENA) {
+        if (stack_arena_init(&arena, kind == SPAWN_REUSE ? REUSE_STACKS : n, SMALL_STACK, kind == SPAWN_ARENA_HUGE) != 0) {
+            fprintf(stderr, "[%s] failed to map the stack arena\n", spawn_names[kind]);
+            free(threads);
+            return;
+        }
+        opts.arena = &arena;
+    }
+
+    set_gate(kind == SPAWN_REUSE);
+    int created = 0, joined = 0;
+    uint64_t start = now_ns();
+    for (; created < n; ++created) {
+        if (kind == SPAWN_REUSE && created - joined == REUSE_STACKS) {
+            assert( spawn_join(&threads[joined++], NULL) == 0 );
+        }
+        int rc = spawn(&threads[created], &opts, gated_entry_point, NULL);
+        if (rc != 0) {
+            fprintf(stderr, "[%s] spawn failed after %d threads: %s\n", spawn_names[kind], created, strerror(rc));
+            break;
+        }
+    }
+    uint64_t elapsed = now_ns() - start;
+    after = footprint();
+    set_gate(1);
+    for (; joined < created; ++joined) {
+        assert( spawn_join(&threads[joined], NULL) == 0 );
+    }
+
+    if (created > 0) {
+        printf("[%s] threads=%d: %.0f threads/s, +%ld MB virtual, +%ld MB resident (%.1f KB per thread), +%ld mappings\n",
+               spawn_names[kind], created, created * 1e9 / elapsed,
+               (after.virtual_kb - before.virtual_kb) / 1024, (after.resident_kb - before.resident_kb) / 1024,
+               (double)(after.resident_kb - before.resident_kb) / (kind == SPAWN_REUSE ? REUSE_STACKS : created),
+               after.mappings - before.mappings);
+    }
+    if (opts.arena) {
+        stack_arena_destroy(&arena);
+    }
+    free(threads);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 3) {
+        printf("Usage: %s [<attributes> [<burst>]]\n"
+               "  attributes: default, small-stack, no-guard, affinity or detached\n"
+               "Time %d create+join round trips, then bursts of 1, 10, 100, 1000 and %d threads "
+               "(or only <burst>), for every kind of attributes or only <attributes>.\n"
+               "       %s many [<threads>]\n"
+               "Keep %d threads (or <threads>) alive at once with default stacks, %d KB stacks, "
+               "%d KB stacks from an arena (of 4 KB or huge pages) and %d recycled arena stacks, "
+               "and report the creation rate and memory footprint.\n",
+               argv[0], ROUND_TRIPS, MAX_BURST, argv[0], MANY_THREADS, SMALL_STACK / 1024, SMALL_STACK / 1024, REUSE_STACKS);
+        exit(1);
+    }
+    if (argc >= 2 && strcmp(argv[1], "many") == 0) {
+        const int n = argc == 3 ? atoi(argv[2]) : MANY_THREADS;
+        if (n < 1) {
+            printf("Error: invalid arguments.\n");
+            exit(1);
+        }
+        for (spawn_kind_t kind = 0; kind < N_SPAWNS; ++kind) {
+            many(kind, n);
+        }
+        return 0;
+    }
+    attr_kind_t only = argc >= 2 ? find_name(attr_names, N_ATTRS, argv[1]) : N_ATTRS;
+    const int only_burst = argc == 3 ? atoi(argv[2]) : 0;
+    if ((argc >= 2 && only == N_ATTRS) || only_burst < 0) {
+        printf("Error: invalid arguments.\n");
+        exit(1);
+    }
+
+    for (attr_kind_t kind = 0; kind < N_ATTRS; ++kind) {
+        if (only != N_ATTRS && kind != only) {
+            continue;
+        }
+        round_trips(kind, ROUND_TRIPS);
+        if (only_burst > 0) {
+            burst(kind, only_burst);
+            continue;
+        }
+        for (int n = 1; n <= MAX_BURST; n *= 10) {
+            burst(kind, n);
+        }
+    }
+    return 0;
+}
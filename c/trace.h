@@ -0,0 +1,210 @@
+/*
+ * Where did the workers run? Every thread records (cpu, node, time)
+ * samples at its task boundaries into its own ring buffer, with no lock
+ * and no system call: getcpu and clock_gettime are vDSO calls. At exit
+ * the rings are merged into one timeline on stderr that flags the
+ * migrations (a thread on another cpu than at its previous sample), the
+ * NUMA crossings (on another node) and the oversubscription (more live
+ * threads than cpus, or live threads last seen on the same cpu).
+ *
+ * Built with `make TRACE=1` (-DTRACE=1); otherwise `trace_point` is
+ * empty. Long loops sample every TRACE_BLOCK bytes of work, which keeps
+ * the cost below 1%. A thread keeps only its last TRACE_RING samples:
+ * past TRACE_RING MB of work (a multi-GB copy) its early samples are
+ * dropped, and `trace_dump` counts them as overwritten; `make TRACE=1
+ * TRACE_RING=16384` keeps a longer history. Define _GNU_SOURCE before
+ * including it, for getcpu.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#define TRACE_BLOCK (1UL << 20) // bytes of work between two samples in a long loop
+
+#if TRACE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/sysinfo.h>
+
+#ifndef TRACE_RING
+#define TRACE_RING 1024 // samples per thread, the oldest are overwritten
+#endif
+
+typedef struct _trace_sample_t {
+    uint64_t ns;        // CLOCK_MONOTONIC
+    unsigned cpu;
+    unsigned node;
+    const char* label;  // a string literal, the task boundary
+} trace_sample_t;
+
+typedef struct _trace_ring_t {
+    trace_sample_t samples[TRACE_RING];
+    unsigned long n;    // samples ever recorded
+    int tid;
+    int index;          // in the timeline of `trace_dump`
+    struct _trace_ring_t* next; // all rings, newest first
+} trace_ring_t;
+
+/* a merged sample, for the timeline */
+typedef struct _trace_event_t {
+    trace_sample_t s;
+    const trace_ring_t* ring;
+} trace_event_t;
+
+static __thread trace_ring_t* trace_self = NULL;
+static trace_ring_t* trace_rings = NULL;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+
+static void trace_dump();
+
+static void trace_register_dump() {
+    atexit(trace_dump);
+}
+
+/* the first sample of a thread sets up its ring */
+static inline trace_ring_t* trace_ring() {
+    if (!trace_self) {
+        pthread_once(&trace_once, trace_register_dump);
+        trace_self = (trace_ring_t*)calloc(1, sizeof(trace_ring_t));
+        if (!trace_self) {
+            return NULL;
+        }
+        trace_self->tid = (int)syscall(SYS_gettid);
+        trace_self->next = __atomic_load_n(&trace_rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&trace_rings, &trace_self->next, trace_self, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+    return trace_self;
+}
+
+/* record where and when the calling thread crosses `label` */
+static inline void trace_point(const char* label) {
+    trace_ring_t* r = trace_ring();
+    if (!r) {
+        return;
+    }
+    trace_sample_t* s = &r->samples[r->n++ % TRACE_RING];
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    s->ns = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    if (getcpu(&s->cpu, &s->node) != 0) {
+        s->cpu = s->node = 0;
+    }
+    s->label = label;
+}
+
+static int trace_cmp_event(const void* a, const void* b) {
+    uint64_t x = ((const trace_event_t*)a)->s.ns, y = ((const trace_event_t*)b)->s.ns;
+    return (x > y) - (x < y);
+}
+
+/*!
+ * \brief merge the rings and print the timeline, one line per sample
+ * with what changed since the thread's previous one. A thread is live
+ * from its first to its last sample; the threads share a cpu when more
+ * than one live thread was last seen on it.
+ */
+static void trace_dump() {
+    trace_ring_t* rings = __atomic_exchange_n(&trace_rings, NULL, __ATOMIC_ACQUIRE);
+    size_t n = 0, overwritten = 0;
+    int n_threads = 0;
+    for (trace_ring_t* r = rings; r; r = r->next) {
+        n += r->n < TRACE_RING ? r->n : TRACE_RING;
+        overwritten += r->n > TRACE_RING ? r->n - TRACE_RING : 0;
+        ++n_threads;
+    }
+    trace_event_t* events = (trace_event_t*)malloc(n * sizeof(trace_event_t));
+    /* per thread, in ring order: the last cpu and node seen, and the time of its last sample */
+    unsigned* last_cpu = (unsigned*)malloc(n_threads * sizeof(unsigned));
+    unsigned* last_node = (unsigned*)malloc(n_threads * sizeof(unsigned));
+    uint64_t* last_ns = (uint64_t*)malloc(n_threads * sizeof(uint64_t));
+    int* seen = (int*)calloc(n_threads, sizeof(int));
+    if (!events || !last_cpu || !last_node || !last_ns || !seen || n == 0) {
+        goto cleanup;
+    }
+
+    size_t e = 0;
+    int t = 0;
+    for (trace_ring_t* r = rings; r; r = r->next, ++t) {
+        unsigned long first = r->n > TRACE_RING ? r->n - TRACE_RING : 0;
+        for (unsigned long i = first; i < r->n; ++i) {
+            events[e].s = r->samples[i % TRACE_RING];
+            events[e].ring = r;
+            ++e;
+        }
+        last_ns[t] = r->samples[(r->n - 1) % TRACE_RING].ns;
+        r->index = t;
+    }
+    qsort(events, n, sizeof(trace_event_t), trace_cmp_event);
+
+    const int nprocs = get_nprocs();
+    long migrations = 0, crossings = 0, shared = 0, oversubscribed = 0;
+    int max_live = 0;
+    fprintf(stderr, "%12s %8s %4s %4s  %-10s %s\n", "time(us)", "tid", "cpu", "node", "label", "event");
+    for (size_t i = 0; i < n; ++i) {
+        const trace_sample_t* s = &events[i].s;
+        const int me = events[i].ring->index;
+        char event[128] = "";
+        int len = 0;
+        if (seen[me] && last_cpu[me] != s->cpu) {
+            len += snprintf(event + len, sizeof(event) - len, "migrated from cpu %u; ", last_cpu[me]);
+            ++migrations;
+        }
+        if (seen[me] && last_node[me] != s->node) {
+            len += snprintf(event + len, sizeof(event) - len, "crossed from node %u; ", last_node[me]);
+            ++crossings;
+        }
+        seen[me] = 1;
+        last_cpu[me] = s->cpu;
+        last_node[me] = s->node;
+
+        int live = 0, same_cpu = 0;
+        for (int j = 0; j < n_threads; ++j) {
+            if (seen[j] && last_ns[j] >= s->ns) {
+                ++live;
+                same_cpu += j != me && last_cpu[j] == s->cpu;
+            }
+        }
+        max_live = live > max_live ? live : max_live;
+        if (same_cpu) {
+            len += snprintf(event + len, sizeof(event) - len, "cpu shared with %d thread(s); ", same_cpu);
+            ++shared;
+        }
+        if (live > nprocs) {
+            len += snprintf(event + len, sizeof(event) - len, "%d live threads on %d cpus; ", live, nprocs);
+            ++oversubscribed;
+        }
+        fprintf(stderr, "%12.3f %8d %4u %4u  %-10s %s\n", (s->ns - events[0].s.ns) / 1e3,
+                events[i].ring->tid, s->cpu, s->node, s->label, event);
+    }
+    fprintf(stderr, "trace: %d threads, %zu samples (%zu overwritten), %ld migrations, %ld node crossings, "
+            "%ld samples on a shared cpu, %ld oversubscribed, up to %d live threads on %d cpus\n",
+            n_threads, n, overwritten, migrations, crossings, shared, oversubscribed, max_live, nprocs);
+
+cleanup:
+    free(events);
+    free(last_cpu);
+    free(last_node);
+    free(last_ns);
+    free(seen);
+    while (rings) {
+        trace_ring_t* next = rings->next;
+        free(rings);
+        rings = next;
+    }
+}
+
+#else
+
+#define trace_point(label) ((void)0)
+
+#endif /* TRACE */
+
+#endif /* TRACE_H */
@@ -0,0 +1,248 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <assert.h>
+#include <time.h>
+#include <sys/sysinfo.h>
+
+#define CACHE_LINE 64
+#define RING_CAPACITY 1024 // cells, a power of two
+#define MAX_BATCH 64
+#define INIT_BALANCE 1000
+#define MAX_AMOUNT 100
+
+#include "mpmc_ring.h"
+#include "util.h"
+
+typedef struct _account_t {
+    int balance;
+    pthread_mutex_t m;
+    int aid;
+} account_t;
+
+typedef struct _transfer_args_t {
+    account_t* from;
+    account_t* to;
+    int amount;
+} transfer_arg_t;
+
+/* what travels through the ring: the transfer, its sequence number and when it was enqueued */
+typedef struct _transfer_msg_t {
+    transfer_arg_t arg;
+    size_t seq;           // unique in [0, n_transfers)
+    uint64_t enqueued_ns;
+} transfer_msg_t;
+
+typedef struct _queue_bench_t {
+    mpmc_ring_t ring;
+    account_t* accounts;
+    int n_accounts;
+    size_t n_transfers;   // per run, split among the producers
+    int n_producers;
+    int batch;            // 1: mpmc_enqueue/mpmc_dequeue, more: the batch operations
+    size_t done;          // transfers dequeued so far, shared by the consumers
+    uint64_t* wait_ns;    // the queue-wait time of each transfer
+    uint64_t* seen;       // one bit per sequence number, set by the consumer that dequeued it
+} queue_bench_t;
+
+typedef struct _producer_arg_t {
+    queue_bench_t* bench;
+    int id;
+} producer_arg_t;
+
+/* `transfer` of bank.c without the printf */
+void transfer(const transfer_arg_t* tran) {
+    if (tran->from->aid < tran->to->aid) {
+        pthread_mutex_lock(&tran->from->m);
+        pthread_mutex_lock(&tran->to->m);
+    } else {
+        pthread_mutex_lock(&tran->to->m);
+        pthread_mutex_lock(&tran->from->m);
+    }
+
+    tran->from->balance -= tran->amount;
+    tran->to->balance += tran->amount;
+
+    pthread_mutex_unlock(&tran->to->m);
+    pthread_mutex_unlock(&tran->from->m);
+}
+
+void* producer(void* arg) {
+    queue_bench_t* bench = ((producer_arg_t*)arg)->bench;
+    const int id = ((producer_arg_t*)arg)->id;
+    uint64_t state = 88172645463325252ull + id;
+    transfer_msg_t msgs[MAX_BATCH];
+
+    /* the first producers take the remainder; each producer numbers its own range */
+    const size_t share = bench->n_transfers / bench->n_producers, rest = bench->n_transfers % bench->n_producers;
+    size_t n = share + (id < rest);
+    size_t seq = id * share + (id < rest ? id : rest);
+    while (n > 0) {
+        size_t k = n < bench->batch ? n : bench->batch;
+        for (size_t i = 0; i < k; ++i) {
+            int from = next_rand(&state) % bench->n_accounts;
+            int to = (from + 1 + next_rand(&state) % (bench->n_accounts - 1)) % bench->n_accounts;
+            msgs[i].arg.from = &bench->accounts[from];
+            msgs[i].arg.to = &bench->accounts[to];
+            msgs[i].arg.amount = next_rand(&state) % MAX_AMOUNT + 1;
+            msgs[i].seq = seq++;
+        }
+
+        size_t sent = 0;
+        while (sent < k) {
+            uint64_t t = now_ns();
+            for (size_t i = sent; i < k; ++i) {
+                msgs[i].enqueued_ns = t;
+            }
+            size_t m = bench->batch == 1 ? mpmc_enqueue(&bench->ring, &msgs[sent])
+                                         : mpmc_enqueue_batch(&bench->ring, &msgs[sent], k - sent);
+            if (m == 0) {
+                sched_yield(); // full, let the consumers run
+            }
+            sent += m;
+        }
+        n -= k;
+    }
+    return NULL;
+}
+
+void* consumer(void* arg) {
+    queue_bench_t* bench = (queue_bench_t*)arg;
+    transfer_msg_t msgs[MAX_BATCH];
+
+    while (__atomic_load_n(&bench->done, __ATOMIC_RELAXED) < bench->n_transfers) {
+        size_t k = bench->batch == 1 ? mpmc_dequeue(&bench->ring, &msgs[0])
+                                     : mpmc_dequeue_batch(&bench->ring, msgs, bench->batch);
+        if (k == 0) {
+            sched_yield(); // empty, let the producers run
+            continue;
+        }
+        uint64_t t = now_ns();
+        size_t slot = __atomic_fetch_add(&bench->done, k, __ATOMIC_RELAXED);
+        for (size_t i = 0; i < k; ++i) {
+            const uint64_t bit = 1ull << msgs[i].seq % 64;
+            /* a transfer the ring handed out twice */
+            assert(!(__atomic_fetch_or(&bench->seen[msgs[i].seq / 64], bit, __ATOMIC_RELAXED) & bit));
+            bench->wait_ns[slot + i] = t - msgs[i].enqueued_ns;
+            transfer(&msgs[i].arg);
+        }
+    }
+    return NULL;
+}
+
+/*!
+ * \brief stream `bench->n_transfers` transfers from `n_producers` through
+ * the ring to `n_consumers` that apply them, and report the transfers/sec
+ * and the p50/p99/max time a transfer waited in the ring
+ */
+void run(queue_bench_t* bench, int n_producers, int n_consumers, int batch) {
+    pthread_t producers[n_producers], consumers[n_consumers];
+    producer_arg_t args[n_producers];
+
+    mpmc_ring_init(&bench->ring, RING_CAPACITY, sizeof(transfer_msg_t));
+    bench->n_producers = n_producers;
+    bench->batch = batch;
+    bench->done = 0;
+    memset(bench->seen, 0, (bench->n_transfers + 63) / 64 * sizeof(uint64_t));
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < n_consumers; ++i) {
+        assert( pthread_create(&consumers[i], NULL, consumer, bench) == 0 );
+    }
+    for (int i = 0; i < n_producers; ++i) {
+        args[i].bench = bench;
+        args[i].id = i;
+        assert( pthread_create(&producers[i], NULL, producer, &args[i]) == 0 );
+    }
+    for (int i = 0; i < n_producers; ++i) {
+        assert( pthread_join(producers[i], NULL) == 0 );
+    }
+    for (int i = 0; i < n_consumers; ++i) {
+        assert( pthread_join(consumers[i], NULL) == 0 );
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    /* every transfer came out of the ring exactly once: no bit was set twice, and none is missing */
+    assert(bench->done == bench->n_transfers);
+    for (size_t i = 0; i < bench->n_transfers; ++i) {
+        assert(bench->seen[i / 64] >> i % 64 & 1);
+    }
+    long long total = 0;
+    for (int i = 0; i < bench->n_accounts; ++i) {
+        total += bench->accounts[i].balance;
+    }
+    assert(total == (long long)bench->n_accounts * INIT_BALANCE);
+
+    size_t n = bench->n_transfers;
+    qsort(bench->wait_ns, n, sizeof(uint64_t), cmp_u64);
+    printf("[batch=%d] producers=%d consumers=%d: %.0f transfers/s, queue wait p50 %lu ns, p99 %lu ns, max %lu ns\n",
+           batch, n_producers, n_consumers, n * 1e9 / elapsed,
+           bench->wait_ns[n / 2], bench->wait_ns[n * 99 / 100], bench->wait_ns[n - 1]);
+
+    mpmc_ring_destroy(&bench->ring);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 6 || argc == 4) {
+        printf("Usage: %s [<transfers> [<accounts> [<producers> <consumers> [<batch>]]]]\n"
+               "Without producers and consumers, sweep both from 1 to all cores with batch 1 and %d.\n",
+               argv[0], MAX_BATCH);
+        exit(1);
+    }
+    queue_bench_t bench;
+    bench.n_transfers = argc >= 2 ? atol(argv[1]) : 1000000;
+    bench.n_accounts = argc >= 3 ? atoi(argv[2]) : 1024;
+    if (bench.n_transfers < 1 || bench.n_accounts < 2) {
+        printf("Error: invalid arguments.\n");
+        exit(1);
+    }
+
+    bench.accounts = (account_t*)malloc(bench.n_accounts * sizeof(account_t));
+    bench.wait_ns = (uint64_t*)malloc(bench.n_transfers * sizeof(uint64_t));
+    bench.seen = (uint64_t*)malloc((bench.n_transfers + 63) / 64 * sizeof(uint64_t));
+    assert(bench.accounts && bench.wait_ns && bench.seen);
+    for (int i = 0; i < bench.n_accounts; ++i) {
+        bench.accounts[i].balance = INIT_BALANCE;
+        bench.accounts[i].aid = i;
+        pthread_mutex_init(&bench.accounts[i].m, NULL);
+    }
+
+    if (argc >= 5) {
+        const int n_producers = atoi(argv[3]);
+        const int n_consumers = atoi(argv[4]);
+        const int batch = argc == 6 ? atoi(argv[5]) : 1;
+        if (n_producers < 1 || n_consumers < 1 || batch < 1 || batch > MAX_BATCH) {
+            printf("Error: invalid arguments.\n");
+            exit(1);
+        }
+        run(&bench, n_producers, n_consumers, batch);
+    } else {
+        const int nprocs = get_nprocs();
+        const int batches[] = { 1, MAX_BATCH };
+        for (int b = 0; b < 2; ++b) {
+            for (int p = 1; ; p = p * 2 < nprocs ? p * 2 : nprocs) {
+                for (int c = 1; ; c = c * 2 < nprocs ? c * 2 : nprocs) {
+                    run(&bench, p, c, batches[b]);
+                    if (c == nprocs) {
+                        break;
+                    }
+                }
+                if (p == nprocs) {
+                    break;
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < bench.n_accounts; ++i) {
+        pthread_mutex_destroy(&bench.accounts[i].m);
+    }
+    free(bench.accounts);
+    free(bench.wait_ns);
+    free(bench.seen);
+    return 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * Small helpers shared by the benchmarks: a monotonic clock in ns, a
+ * xorshift64* generator, a qsort comparator, the lookup of a command
+ * line name and a timed lock that skips the clock read when the mutex
+ * is free.
+ */
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+/* CLOCK_MONOTONIC, the clock every benchmark times with */
+static inline uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* xorshift64*, one state per generator so no locking is needed */
+static inline uint64_t next_rand(uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ull;
+}
+
+/* ascending uint64_t, for qsort */
+static inline int cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+/* the index of `name` in `names`, or `n` if there is none */
+static inline int find_name(const char* names[], int n, const char* name) {
+    int i = 0;
+    while (i < n && strcmp(names[i], name)) {
+        ++i;
+    }
+    return i;
+}
+
+/* take `m` within `timeout_ns`, without reading the clock when it is free */
+static inline int timed_lock(pthread_mutex_t* m, long timeout_ns) {
+    if (pthread_mutex_trylock(m) == 0) {
+        return 0;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += timeout_ns;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000;
+    deadline.tv_nsec %= 1000000000;
+    return pthread_mutex_timedlock(m, &deadline);
+}
+
+#endif /* UTIL_H */
@@ -5,11 +5,23 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/syscall.h>
 #include <sys/sysinfo.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "trace.h"
+
+/* page options for the vectors */
+#define PAGE_4K "4k"   // malloc, regular pages
+#define PAGE_THP "thp" // transparent huge pages, madvise(MADV_HUGEPAGE)
+#define PAGE_2M "2m"   // explicit 2 MB hugetlbfs pages
+#define PAGE_1G "1g"   // explicit 1 GB hugetlbfs pages
+
+static const char *page_option = PAGE_4K;
+
 typedef struct _arg_t {
   float *dst;
   float *src;
@@ -23,8 +35,33 @@ void init_array(float *p, size_t len) {
   }
 }
 
+/* round up to the huge page size, so the hugetlbfs mapping and its fallback have the same length */
+size_t mapping_length(size_t size) {
+  size_t huge = strcmp(page_option, PAGE_1G) == 0 ? (1UL << 30) : (2UL << 20);
+  return (size + huge - 1) / huge * huge;
+}
+
 float *gen_array(size_t len) {
-  float *p = (float *)malloc(len * sizeof(float));
+  float *p;
+  if (strcmp(page_option, PAGE_4K) == 0) {
+    p = (float *)malloc(len * sizeof(float));
+  } else {
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    size_t map_len = mapping_length(len * sizeof(float));
+    void *m = MAP_FAILED;
+    if (strcmp(page_option, PAGE_2M) == 0) {
+      m = mmap(NULL, map_len, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+    } else if (strcmp(page_option, PAGE_1G) == 0) {
+      m = mmap(NULL, map_len, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB | (30 << MAP_HUGE_SHIFT), -1, 0);
+    }
+    if (m == MAP_FAILED) {  // fall back to transparent huge pages
+      m = mmap(NULL, map_len, PROT_READ | PROT_WRITE, flags, -1, 0);
+      if (m != MAP_FAILED) {
+        madvise(m, map_len, MADV_HUGEPAGE);
+      }
+    }
+    p = m == MAP_FAILED ? NULL : (float *)m;
+  }
   if (!p) {
     printf("failed to allocate %ld bytes memory!", len * sizeof(float));
     exit(1);
@@ -32,15 +69,60 @@ float *gen_array(size_t len) {
   return p;
 }
 
+void free_array(float *p, size_t len) {
+  if (strcmp(page_option, PAGE_4K) == 0) {
+    free(p);
+  } else {
+    munmap(p, mapping_length(len * sizeof(float)));
+  }
+}
+
+/* the page size backing `addr` according to /proc/self/smaps, 0 if unknown */
+size_t backed_page_size(const void *addr) {
+  FILE *fp = fopen("/proc/self/smaps", "r");
+  if (!fp) {
+    return 0;
+  }
+  char line[256];
+  int in_vma = 0;
+  size_t kernel_kb = 0, anon_huge_kb = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    unsigned long start, end;
+    if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+      if (in_vma) {
+        break;
+      }
+      in_vma = (unsigned long)addr >= start && (unsigned long)addr < end;
+    } else if (in_vma) {
+      sscanf(line, "KernelPageSize: %lu kB", &kernel_kb);
+      sscanf(line, "AnonHugePages: %lu kB", &anon_huge_kb);
+    }
+  }
+  fclose(fp);
+  return anon_huge_kb > 0 ? (2UL << 20) : kernel_kb * 1024;
+}
+
 void *vec_sum(void *args) {
   arg_t *vec = (arg_t *)args;
 
   float *dst = vec->dst;
   float *src = vec->src;
   size_t len = vec->len;
+#if TRACE
+  const size_t block = TRACE_BLOCK / sizeof(float); // a trace sample per block
+  trace_point("sum");
+  for (size_t b = 0; b < len; b += block) {
+    size_t end = b + block < len ? b + block : len;
+    for (size_t i = b; i < end; ++i) {
+      dst[i] += src[i];
+    }
+    trace_point("block");
+  }
+#else
   for (int i = 0; i < len; ++i) {
     dst[i] += src[i];
   }
+#endif
 
   return NULL;
 }
@@ -107,19 +189,28 @@ void run(arg_t *args, int k, int flag) {
 
   uint64_t delta_us = (end.tv_sec - start.tv_sec) * 1.0e6 +
                       (end.tv_nsec - start.tv_nsec) * 1.0e-3;
-  printf("The elapsed time is %.2f ms.\n", delta_us / 1000.0);
+  printf("The elapsed time is %.2f ms (dst %lu KB / src %lu KB pages).\n", delta_us / 1000.0,
+         backed_page_size(args[0].dst) / 1024, backed_page_size(args[0].src) / 1024);
 }
 
 int main(int argc, char *argv[]) {
-  if (argc != 3) {
-    printf("Error: The number of input integers now is %d. Please input 3 "
-           "integers.\n",
+  if (argc != 3 && argc != 4) {
+    printf("Error: The number of input integers now is %d. Please input 2 "
+           "integers and optionally the page option (4k, thp, 2m or 1g).\n",
            argc - 1);
     exit(1);
   }
   const int num = atoi(argv[1]);
   const int k = atoi(argv[2]);
-  printf("vector len=%d. thread num=%d\n", num, k);
+  if (argc == 4) {
+    page_option = argv[3];
+    if (strcmp(page_option, PAGE_4K) && strcmp(page_option, PAGE_THP) &&
+        strcmp(page_option, PAGE_2M) && strcmp(page_option, PAGE_1G)) {
+      printf("Error: unknown page option %s.\n", page_option);
+      exit(1);
+    }
+  }
+  printf("vector len=%d. thread num=%d. pages=%s\n", num, k, page_option);
 
   srand(time(NULL));
 
@@ -145,8 +236,8 @@ int main(int argc, char *argv[]) {
   // with setting affinity
   run(args, k, 1);
 
-  free(dst);
-  free(src);
+  free_array(dst, num);
+  free_array(src, num);
 
   return 0;
 }